@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+
+//
+// Example to show how to control 3 thyristor dimmers on a three-phase grid, with one ZCD per phase
+//
+
+#include <Arduino.h>
+#include <MycilaDimmers.h>
+#include <MycilaPulseAnalyzer.h>
+
+#if defined(CONFIG_IDF_TARGET_ESP32)
+  #define GPIO_DIMMER_L1 GPIO_NUM_25
+  #define GPIO_DIMMER_L2 GPIO_NUM_26
+  #define GPIO_DIMMER_L3 GPIO_NUM_27
+  #define GPIO_ZCD_L1    GPIO_NUM_35
+  #define GPIO_ZCD_L2    GPIO_NUM_34
+  #define GPIO_ZCD_L3    GPIO_NUM_39
+#else
+  #define GPIO_DIMMER_L1 GPIO_NUM_20
+  #define GPIO_DIMMER_L2 GPIO_NUM_21
+  #define GPIO_DIMMER_L3 GPIO_NUM_10
+  #define GPIO_ZCD_L1    GPIO_NUM_8
+  #define GPIO_ZCD_L2    GPIO_NUM_7
+  #define GPIO_ZCD_L3    GPIO_NUM_6
+#endif
+
+static Mycila::PulseAnalyzer pulseAnalyzerL1;
+static Mycila::PulseAnalyzer pulseAnalyzerL2;
+static Mycila::PulseAnalyzer pulseAnalyzerL3;
+
+// one group per phase: the groups share one firing timer, but each one has its own firing schedule and is synchronized on its own ZCD
+static Mycila::ThyristorDimmer::Group groupL1;
+static Mycila::ThyristorDimmer::Group groupL2;
+static Mycila::ThyristorDimmer::Group groupL3;
+
+static Mycila::ThyristorDimmer dimmerL1;
+static Mycila::ThyristorDimmer dimmerL2;
+static Mycila::ThyristorDimmer dimmerL3;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    continue;
+
+  // each ZCD fires the dimmers of its group
+  pulseAnalyzerL1.onZeroCross(Mycila::ThyristorDimmer::onZeroCross, &groupL1);
+  pulseAnalyzerL2.onZeroCross(Mycila::ThyristorDimmer::onZeroCross, &groupL2);
+  pulseAnalyzerL3.onZeroCross(Mycila::ThyristorDimmer::onZeroCross, &groupL3);
+  pulseAnalyzerL1.begin(GPIO_ZCD_L1);
+  pulseAnalyzerL2.begin(GPIO_ZCD_L2);
+  pulseAnalyzerL3.begin(GPIO_ZCD_L3);
+
+  // Wait until the grid frequency is detected (50Hz or 60Hz)
+  while (!pulseAnalyzerL1.getNominalGridSemiPeriod()) {
+    Serial.printf("Waiting for grid frequency detection...\n");
+    delay(200);
+  }
+
+  // All the phases share the same nominal frequency: the global semi-period is used by the power LUT.
+  // Groups can also be given their own semi-period if needed with Group::setSemiPeriod().
+  Serial.printf("Grid frequency detected: %d Hz\n", pulseAnalyzerL1.getNominalGridFrequency());
+  Mycila::Dimmer::setSemiPeriod(pulseAnalyzerL1.getNominalGridSemiPeriod());
+
+  dimmerL1.setPin(GPIO_DIMMER_L1);
+  dimmerL2.setPin(GPIO_DIMMER_L2);
+  dimmerL3.setPin(GPIO_DIMMER_L3);
+
+  // the group must be set before begin()
+  dimmerL1.setGroup(groupL1);
+  dimmerL2.setGroup(groupL2);
+  dimmerL3.setGroup(groupL3);
+
+  dimmerL1.enablePowerLUT(true);
+  dimmerL2.enablePowerLUT(true);
+  dimmerL3.enablePowerLUT(true);
+
+  dimmerL1.begin();
+  dimmerL2.begin();
+  dimmerL3.begin();
+
+  dimmerL1.setOnline(true);
+  dimmerL2.setOnline(true);
+  dimmerL3.setOnline(true);
+}
+
+void loop() {
+  // same duty cycle on all phases to keep the three-phase load balanced
+  for (int i = 0; i <= 100; i++) {
+    dimmerL1.setDutyCycle(i / 100.0f);
+    dimmerL2.setDutyCycle(i / 100.0f);
+    dimmerL3.setDutyCycle(i / 100.0f);
+    delay(100);
+  }
+  for (int i = 100; i >= 0; i--) {
+    dimmerL1.setDutyCycle(i / 100.0f);
+    dimmerL2.setDutyCycle(i / 100.0f);
+    dimmerL3.setDutyCycle(i / 100.0f);
+    delay(100);
+  }
+}
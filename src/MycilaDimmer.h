@@ -13,11 +13,22 @@
   #include <ArduinoJson.h>
 #endif
 
+#include "MycilaDimmerSnapshot.h"
+
 #include <assert.h>
 #include <esp32-hal-gpio.h>
 
+#include <atomic>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+  #include <mutex>
+#endif
+
+// Number of harmonics (H1, H3, ..., H21) cached and serialized by toJson()
+#define MYCILA_DIMMER_HARMONICS 11
 
 namespace Mycila {
   class Dimmer {
@@ -33,6 +44,9 @@ namespace Mycila {
       } Metrics;
 
     public:
+      // Duty cycles of the integer API, in Q16: 0 is 0%, DUTY_CYCLE_RAW_MAX is 100%
+      static constexpr uint16_t DUTY_CYCLE_RAW_MAX = 0xFFFF;
+
       virtual ~Dimmer() { end(); };
 
       virtual bool begin() {
@@ -52,9 +66,9 @@ namespace Mycila {
        * @param limit: the power duty cycle limit in the range [0.0, 1.0]
        */
       void setDutyCycleLimit(float limit) {
-        _dutyCycleLimit = _contrain(limit, 0, 1);
-        if (_dutyCycle > _dutyCycleLimit)
-          setDutyCycle(_dutyCycleLimit);
+        _dutyCycleLimitRaw = _toRaw(limit);
+        if (_dutyCycleRaw > _dutyCycleLimitRaw)
+          setDutyCycleRaw(_dutyCycleLimitRaw);
       }
 
       /**
@@ -64,8 +78,9 @@ namespace Mycila {
        * @param min: Set the new "0" value for the power duty cycle. The duty cycle in the range [0.0, 1.0] will be remapped to [min, max].
        */
       void setDutyCycleMin(float min) {
-        _dutyCycleMin = _contrain(min, 0, _dutyCycleMax);
-        setDutyCycle(_dutyCycle);
+        const uint16_t raw = _toRaw(min);
+        _dutyCycleMinRaw = raw < _dutyCycleMaxRaw ? raw : _dutyCycleMaxRaw;
+        setDutyCycleRaw(_dutyCycleRaw);
       }
 
       /**
@@ -75,24 +90,25 @@ namespace Mycila {
        * @param max: Set the new "1" value for the power duty cycle. The duty cycle in the range [0.0, 1.0] will be remapped to [min, max].
        */
       void setDutyCycleMax(float max) {
-        _dutyCycleMax = _contrain(max, _dutyCycleMin, 1);
-        setDutyCycle(_dutyCycle);
+        const uint16_t raw = _toRaw(max);
+        _dutyCycleMaxRaw = raw > _dutyCycleMinRaw ? raw : _dutyCycleMinRaw;
+        setDutyCycleRaw(_dutyCycleRaw);
       }
 
       /**
        * @brief Get the power duty cycle limit of the dimmer
        */
-      float getDutyCycleLimit() const { return _dutyCycleLimit; }
+      float getDutyCycleLimit() const { return _fromRaw(_dutyCycleLimitRaw); }
 
       /**
        * @brief Get the remapped "0" of the dimmer duty cycle
        */
-      float getDutyCycleMin() const { return _dutyCycleMin; }
+      float getDutyCycleMin() const { return _fromRaw(_dutyCycleMinRaw); }
 
       /**
        * @brief Get the remapped "1" of the dimmer duty cycle
        */
-      float getDutyCycleMax() const { return _dutyCycleMax; }
+      float getDutyCycleMax() const { return _fromRaw(_dutyCycleMaxRaw); }
 
       /////////////////
       // SEMi-PERIOD //
@@ -132,11 +148,11 @@ namespace Mycila {
       void setOnline(bool online) {
         _online = online;
         if (!_online) {
-          _dutyCycleFire = 0.0f;
+          _dutyCycleFireRaw = 0;
           if (_enabled)
             _apply();
         } else {
-          setDutyCycle(_dutyCycle);
+          setDutyCycleRaw(_dutyCycleRaw);
         }
       }
 
@@ -147,12 +163,12 @@ namespace Mycila {
       /**
        * @brief Turn on the dimmer at full power
        */
-      void on() { setDutyCycle(1); }
+      void on() { setDutyCycleRaw(DUTY_CYCLE_RAW_MAX); }
 
       /**
        * @brief Turn off the dimmer
        */
-      void off() { setDutyCycle(0); }
+      void off() { setDutyCycleRaw(0); }
 
       /**
        * @brief Check if the dimmer is off
@@ -162,26 +178,49 @@ namespace Mycila {
       /**
        * @brief Check if the dimmer is on
        */
-      bool isOn() const { return isOnline() && _dutyCycle; }
+      bool isOn() const { return isOnline() && _dutyCycleRaw; }
 
       /**
        * @brief Check if the dimmer is on at full power
        */
-      bool isOnAtFullPower() const { return _dutyCycle >= _dutyCycleMax; }
+      bool isOnAtFullPower() const { return _dutyCycleRaw >= _dutyCycleMaxRaw; }
 
       /**
        * @brief Set the power duty
        *
+       * @warning Not virtual: all the duty cycle changes (including the ones of Dimmers) go through setDutyCycleRaw(), which is the one to override in a custom dimmer.
+       * A setDutyCycle(float) declared in a subclass only hides this one, and is not called through a Dimmer& or Dimmer*.
+       *
        * @param dutyCycle: the power duty cycle in the range [0.0, 1.0]
        */
-      virtual bool setDutyCycle(float dutyCycle) {
-        // Apply limit and save the wanted duty cycle.
-        // It will only be applied when dimmer will be on.
-        _dutyCycle = _contrain(dutyCycle, 0, _dutyCycleLimit);
-        _dutyCycleFire = getDutyCycleMapped();
+      bool setDutyCycle(float dutyCycle) { return setDutyCycleRaw(_toRaw(dutyCycle)); }
+
+      /**
+       * @brief Set the power duty with integer math only (no float emulation on the targets without FPU, like the ESP32-C2 / C3)
+       *
+       * @param dutyCycle: the power duty cycle in Q16, in the range [0, DUTY_CYCLE_RAW_MAX]
+       */
+      virtual bool setDutyCycleRaw(uint16_t dutyCycle) {
+        _updateDutyCycleRaw(dutyCycle);
         return isOnline() && _apply();
       }
 
+      /**
+       * @brief Ramp the power duty cycle linearly to a target duty cycle in a given duration (soft start, smooth transitions)
+       * @brief Dimmers driven by a firing ISR (thyristor, cycle stealing) advance the ramp by themselves at each semi-period, without any task.
+       * @brief Other dimmers directly apply the target duty cycle: this base implementation ignores the duration and applies the target immediately, like setDutyCycle().
+       * @brief During the ramp, the duty cycle getters already return the target. Any other duty cycle change cancels the ramp.
+       *
+       * @param dutyCycle: the target power duty cycle in the range [0.0, 1.0]
+       * @param durationMs: the duration of the ramp in ms (0: set the duty cycle immediately)
+       */
+      virtual bool rampTo(float dutyCycle, uint32_t /* durationMs */) { return setDutyCycle(dutyCycle); }
+
+      /**
+       * @brief Returns true if a ramp started with rampTo() has not reached its target yet
+       */
+      virtual bool isRamping() const { return false; }
+
       ////////////////
       // DUTY CYCLE //
       ////////////////
@@ -189,12 +228,14 @@ namespace Mycila {
       /**
        * @brief Get the power duty cycle configured for the dimmer by  the  user
        */
-      float getDutyCycle() const { return _dutyCycle; }
+      float getDutyCycle() const { return _fromRaw(_dutyCycleRaw); }
+      uint16_t getDutyCycleRaw() const { return _dutyCycleRaw; }
 
       /**
        * @brief Get the remapped power duty cycle from the currently user set duty cycle
        */
-      float getDutyCycleMapped() const { return _dutyCycleMin + _dutyCycle * (_dutyCycleMax - _dutyCycleMin); }
+      float getDutyCycleMapped() const { return _fromRaw(getDutyCycleMappedRaw()); }
+      uint16_t getDutyCycleMappedRaw() const { return _dutyCycleMinRaw + _scaleRaw(_dutyCycleRaw, _dutyCycleMaxRaw - _dutyCycleMinRaw); }
 
       /**
        * @brief Get the real firing duty cycle (conduction duty cycle) applied to the dimmer in the range [0, 1]
@@ -204,7 +245,8 @@ namespace Mycila {
        * The firing ratio represents the actual proportion of time the dimmer is conducting power to the load within each AC cycle.
        * It is computed based on the remapped duty cycle and eventually the power LUT if enabled.
        */
-      float getDutyCycleFire() const { return isOnline() ? _dutyCycleFire : 0.0f; }
+      float getDutyCycleFire() const { return _fromRaw(getDutyCycleFireRaw()); }
+      uint16_t getDutyCycleFireRaw() const { return isOnline() ? _dutyCycleFireRaw : 0; }
 
       /////////////
       // METRICS //
@@ -219,78 +261,48 @@ namespace Mycila {
       // array[0] = H1 (fundamental), array[1] = H3, array[2] = H5, array[3] = H7, etc.
       // Only odd harmonics are calculated (even harmonics are negligible for symmetric dimmers)
       // Returns true if harmonics were calculated, false if dimmer is not active
+      // The first MYCILA_DIMMER_HARMONICS harmonics are cached and only recomputed when the firing duty cycle changes
       bool calculateHarmonics(float* array, size_t n) const {
         if (array == nullptr || n == 0)
           return false;
 
-        float duty = getDutyCycleFire();
+        if (n > MYCILA_DIMMER_HARMONICS)
+          return _computeHarmonics(array, n, getDutyCycleFire());
 
-        // Check if dimmer is active and routing
-        if (duty <= 0.0f) {
-          for (size_t i = 0; i < n; i++) {
-            array[i] = 0.0f; // No power, no harmonics
-          }
-          return true;
-        }
-
-        if (duty >= 1.0f) {
-          array[0] = 100.0f; // H1 (fundamental) = 100% reference
-          for (size_t i = 1; i < n; i++) {
-            array[i] = 0.0f; // No harmonics at full power
-          }
-          return true;
-        }
-
-        // Initialize all values to NAN
-        for (size_t i = 0; i < n; i++) {
-          array[i] = NAN;
+#ifndef MYCILA_DIMMER_NO_LOCK
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+#endif
+        // the harmonics are computed from the duty cycle the cache is keyed by, even if it changes in the meantime
+        const float duty = getDutyCycleFire();
+        if (!_harmonicsCache.valid || _harmonicsCache.dutyCycleFire != duty) {
+          _harmonicsCache.result = _computeHarmonics(_harmonicsCache.harmonics, MYCILA_DIMMER_HARMONICS, duty);
+          _harmonicsCache.dutyCycleFire = duty;
+          _harmonicsCache.valid = true;
         }
 
-        return _calculateDimmerHarmonics(array, n);
+        memcpy(array, _harmonicsCache.harmonics, n * sizeof(float));
+        return _harmonicsCache.result;
       }
 
+      // The result is cached and only recomputed when the power ratio, grid voltage or load resistance change
       bool calculateMetrics(Metrics& metrics, float gridVoltage, float loadResistance) const {
         if (!_enabled || loadResistance <= 0 || gridVoltage <= 0) {
           return false;
         }
 
+#ifndef MYCILA_DIMMER_NO_LOCK
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+#endif
         const float powerRatio = getPowerRatio();
-
-        if (powerRatio <= 0) {
-          // no power
-          metrics.apparentPower = 0.0f;
-          metrics.current = 0.0f;
-          metrics.power = 0.0f;
-          metrics.powerFactor = NAN;
-          metrics.thdi = NAN;
-          metrics.voltage = 0.0f;
-          return true;
+        if (!_metricsCache.valid || _metricsCache.powerRatio != powerRatio || _metricsCache.gridVoltage != gridVoltage || _metricsCache.loadResistance != loadResistance) {
+          _computeMetrics(_metricsCache.metrics, powerRatio, gridVoltage, loadResistance);
+          _metricsCache.powerRatio = powerRatio;
+          _metricsCache.gridVoltage = gridVoltage;
+          _metricsCache.loadResistance = loadResistance;
+          _metricsCache.valid = true;
         }
 
-        if (powerRatio >= 1) {
-          // full power
-          const float nominalPower = gridVoltage * gridVoltage / loadResistance;
-          metrics.apparentPower = nominalPower;
-          metrics.current = gridVoltage / loadResistance;
-          metrics.power = nominalPower;
-          metrics.powerFactor = 1.0f;
-          metrics.thdi = 0.0f;
-          metrics.voltage = gridVoltage;
-          return true;
-        }
-
-        const float nominalPower = gridVoltage * gridVoltage / loadResistance;
-
-        metrics.power = powerRatio * nominalPower;
-        metrics.powerFactor = std::sqrt(powerRatio);
-        metrics.voltage = metrics.powerFactor * gridVoltage;
-        metrics.current = metrics.voltage / loadResistance;
-        metrics.apparentPower = gridVoltage * metrics.current;
-
-        // THDi calculation for resistive load:
-        // PF = 1 / sqrt(1 + THDi^2) => THDi = sqrt(1/PF^2 - 1)
-        metrics.thdi = 100.0f * std::sqrt(1.0f / (metrics.powerFactor * metrics.powerFactor) - 1.0f);
-
+        metrics = _metricsCache.metrics;
         return true;
       }
 
@@ -301,7 +313,7 @@ namespace Mycila {
        * @param root: the JSON object to serialize to
        */
       virtual void toJson(const JsonObject& root) const {
-        static const char* H_LEVELS[] = {"H1", "H3", "H5", "H7", "H9", "H11", "H13", "H15", "H17", "H19", "H21"};
+        static const char* H_LEVELS[MYCILA_DIMMER_HARMONICS] = {"H1", "H3", "H5", "H7", "H9", "H11", "H13", "H15", "H17", "H19", "H21"};
 
         root["type"] = type();
         root["enabled"] = isEnabled();
@@ -315,39 +327,166 @@ namespace Mycila {
         root["duty_cycle_min"] = getDutyCycleMin();
         root["duty_cycle_max"] = getDutyCycleMax();
         JsonObject harmonics = root["harmonics"].to<JsonObject>();
-        float* output = new float[11]; // H1 to H21
-        if (calculateHarmonics(output, 11)) {
-          for (size_t i = 0; i < 11; i++) {
+        float output[MYCILA_DIMMER_HARMONICS]; // H1 to H21
+        if (calculateHarmonics(output, MYCILA_DIMMER_HARMONICS)) {
+          for (size_t i = 0; i < MYCILA_DIMMER_HARMONICS; i++) {
             if (!std::isnan(output[i])) {
               harmonics[H_LEVELS[i]] = output[i];
             }
           }
         }
-        delete[] output;
       }
 #endif
 
+      /**
+       * @brief Fill a binary snapshot of the dimmer: a compact alternative to toJson() for high rate telemetry
+       *
+       * @param snapshot: the snapshot to fill, which should be default-constructed
+       */
+      virtual void toSnapshot(DimmerSnapshot& snapshot) const {
+        snapshot.setFlag(DimmerSnapshot::ENABLED, isEnabled());
+        snapshot.setFlag(DimmerSnapshot::ONLINE, isOnline());
+        snapshot.setFlag(DimmerSnapshot::ON, isOn());
+        snapshot.semiPeriod = getSemiPeriod();
+        snapshot.dutyCycle = DimmerSnapshot::toRatio(getDutyCycle());
+        snapshot.dutyCycleMapped = DimmerSnapshot::toRatio(getDutyCycleMapped());
+        snapshot.dutyCycleFire = DimmerSnapshot::toRatio(getDutyCycleFire());
+        snapshot.dutyCycleLimit = DimmerSnapshot::toRatio(getDutyCycleLimit());
+        snapshot.dutyCycleMin = DimmerSnapshot::toRatio(getDutyCycleMin());
+        snapshot.dutyCycleMax = DimmerSnapshot::toRatio(getDutyCycleMax());
+        float output[MYCILA_DIMMER_HARMONICS]; // H1 to H21
+        if (calculateHarmonics(output, MYCILA_DIMMER_HARMONICS)) {
+          snapshot.setFlag(DimmerSnapshot::HARMONICS, true);
+          for (size_t i = 0; i < MYCILA_DIMMER_HARMONICS; i++)
+            snapshot.harmonics[i] = DimmerSnapshot::toHarmonic(output[i]);
+        }
+      }
+
+      /**
+       * @brief Write the binary snapshot of the dimmer (see DimmerSnapshot) to a caller-provided buffer
+       *
+       * @return the number of bytes written (sizeof(DimmerSnapshot)), or 0 if the buffer is too small
+       */
+      size_t writeSnapshot(uint8_t* buffer, size_t size) const {
+        if (buffer == nullptr || size < sizeof(DimmerSnapshot))
+          return 0;
+        DimmerSnapshot snapshot;
+        toSnapshot(snapshot);
+        memcpy(buffer, &snapshot, sizeof(DimmerSnapshot));
+        return sizeof(DimmerSnapshot);
+      }
+
+      /**
+       * @brief Write the snapshot of the dimmer encoded as a MessagePack array (see DimmerSnapshot::toMsgPack()) to a caller-provided buffer
+       *
+       * @return the number of bytes written, or 0 if the buffer is too small
+       */
+      size_t writeSnapshotMsgPack(uint8_t* buffer, size_t size) const {
+        DimmerSnapshot snapshot;
+        toSnapshot(snapshot);
+        return snapshot.toMsgPack(buffer, size);
+      }
+
     protected:
-      bool _enabled = false;
+      // atomic: also written by the I2C worker task of the DFRobot dimmers started with beginAsync()
+      std::atomic<bool> _enabled{false};
       bool _online = false;
 
-      float _dutyCycle = 0.0f;
-      float _dutyCycleFire = 0.0f;
-      float _dutyCycleLimit = 1.0f;
-      float _dutyCycleMin = 0.0f;
-      float _dutyCycleMax = 1.0f;
+      // duty cycles in Q16 (see DUTY_CYCLE_RAW_MAX): the float API only converts from / to them
+      uint16_t _dutyCycleRaw = 0;
+      uint16_t _dutyCycleFireRaw = 0;
+      uint16_t _dutyCycleLimitRaw = DUTY_CYCLE_RAW_MAX;
+      uint16_t _dutyCycleMinRaw = 0;
+      uint16_t _dutyCycleMaxRaw = DUTY_CYCLE_RAW_MAX;
 
       inline static uint16_t _semiPeriod = 0;
 
       virtual bool _apply() { return _enabled; }
 
-      virtual bool _calculateDimmerHarmonics(float* array, size_t n) const {
+      // Apply limit and save the wanted duty cycle (it will only be applied when dimmer will be on), then compute the one to fire.
+      // Not virtual: the final dimmer classes call it from their own setDutyCycleRaw(), followed by their own isOnline() and _apply(), without any virtual call.
+      void _updateDutyCycleRaw(uint16_t dutyCycle) {
+        _dutyCycleRaw = dutyCycle < _dutyCycleLimitRaw ? dutyCycle : _dutyCycleLimitRaw;
+        _dutyCycleFireRaw = getDutyCycleMappedRaw();
+      }
+
+      // Batched updates (see Dimmers::commit()): while _batching is set, _apply() only has to update the dimmer state if the dimmer has a batch resource.
+      // The state of all the dimmers sharing the same resource (firing ISR, group...) is then published once to the hardware by _applyBatch().
+      friend class Dimmers;
+      bool _batching = false;
+      virtual const void* _batchResource() const { return nullptr; } // nullptr: the dimmer is applied immediately
+      virtual bool _applyBatch() { return _apply(); }
+
+      // duty: firing duty cycle in ]0, 1[ to compute the harmonics for
+      virtual bool _calculateDimmerHarmonics(float* array, size_t n, float /* duty */) const {
         for (size_t i = 0; i < n; i++) {
           array[i] = 0.0f; // No harmonics for default dimmer
         }
         return true;
       }
 
+      bool _computeHarmonics(float* array, size_t n, float duty) const {
+        // Check if dimmer is active and routing
+        if (duty <= 0.0f) {
+          for (size_t i = 0; i < n; i++) {
+            array[i] = 0.0f; // No power, no harmonics
+          }
+          return true;
+        }
+
+        if (duty >= 1.0f) {
+          array[0] = 100.0f; // H1 (fundamental) = 100% reference
+          for (size_t i = 1; i < n; i++) {
+            array[i] = 0.0f; // No harmonics at full power
+          }
+          return true;
+        }
+
+        // Initialize all values to NAN
+        for (size_t i = 0; i < n; i++) {
+          array[i] = NAN;
+        }
+
+        return _calculateDimmerHarmonics(array, n, duty);
+      }
+
+      static void _computeMetrics(Metrics& metrics, float powerRatio, float gridVoltage, float loadResistance) {
+        if (powerRatio <= 0) {
+          // no power
+          metrics.apparentPower = 0.0f;
+          metrics.current = 0.0f;
+          metrics.power = 0.0f;
+          metrics.powerFactor = NAN;
+          metrics.thdi = NAN;
+          metrics.voltage = 0.0f;
+          return;
+        }
+
+        if (powerRatio >= 1) {
+          // full power
+          const float nominalPower = gridVoltage * gridVoltage / loadResistance;
+          metrics.apparentPower = nominalPower;
+          metrics.current = gridVoltage / loadResistance;
+          metrics.power = nominalPower;
+          metrics.powerFactor = 1.0f;
+          metrics.thdi = 0.0f;
+          metrics.voltage = gridVoltage;
+          return;
+        }
+
+        const float nominalPower = gridVoltage * gridVoltage / loadResistance;
+
+        metrics.power = powerRatio * nominalPower;
+        metrics.powerFactor = std::sqrt(powerRatio);
+        metrics.voltage = metrics.powerFactor * gridVoltage;
+        metrics.current = metrics.voltage / loadResistance;
+        metrics.apparentPower = gridVoltage * metrics.current;
+
+        // THDi calculation for resistive load:
+        // PF = 1 / sqrt(1 + THDi^2) => THDi = sqrt(1/PF^2 - 1)
+        metrics.thdi = 100.0f * std::sqrt(1.0f / (metrics.powerFactor * metrics.powerFactor) - 1.0f);
+      }
+
       ////////////////////
       // STATIC HELPERS //
       ////////////////////
@@ -355,5 +494,46 @@ namespace Mycila {
       static inline float _contrain(float amt, float low, float high) {
         return (amt < low) ? low : ((amt > high) ? high : amt);
       }
+
+      // ratio in [0, 1] to Q16 (NaN gives 0)
+      static inline uint16_t _toRaw(float ratio) {
+        if (!(ratio > 0.0f))
+          return 0;
+        if (ratio >= 1.0f)
+          return DUTY_CYCLE_RAW_MAX;
+        return static_cast<uint16_t>(ratio * DUTY_CYCLE_RAW_MAX + 0.5f);
+      }
+
+      static inline float _fromRaw(uint16_t raw) { return raw * (1.0f / DUTY_CYCLE_RAW_MAX); }
+
+      // value * ratio / DUTY_CYCLE_RAW_MAX, rounded, with a multiplication instead of a division (for values up to 2^31)
+      static inline uint32_t _scaleRaw(uint16_t ratio, uint32_t value) {
+        return (static_cast<uint64_t>(value) * ratio * 65537 + (1ULL << 31)) >> 32;
+      }
+
+    private:
+      // results of the last calculateHarmonics() / calculateMetrics() calls, to avoid recomputing them at each serialization.
+      // They are keyed by their inputs: the firing duty cycle already reflects the semi-period and power LUT mode changes, and so does the power ratio.
+      mutable struct {
+          bool valid = false;
+          bool result = false;
+          float dutyCycleFire = 0.0f;
+          float harmonics[MYCILA_DIMMER_HARMONICS];
+      } _harmonicsCache;
+
+      mutable struct {
+          bool valid = false;
+          float powerRatio = 0.0f;
+          float gridVoltage = 0.0f;
+          float loadResistance = 0.0f;
+          Metrics metrics;
+      } _metricsCache;
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+      // the const getters can be called from several tasks (web server, MQTT...): serializes the updates of the caches
+      mutable std::mutex _cacheMutex;
+#else
+      // without lock, calculateHarmonics() and calculateMetrics() must not be called concurrently on the same dimmer
+#endif
   };
 } // namespace Mycila
@@ -6,19 +6,27 @@
 
 // lock
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <mutex>
 
 // gpio
 #include <driver/gpio.h>
-#include <driver/gptimer_types.h>
 #include <esp32-hal-gpio.h>
-#include <hal/gpio_ll.h>
-#include <soc/gpio_struct.h>
 
 // logging
 #include <esp32-hal-log.h>
 
 // timers
-#include "priv/inlined_gptimer.h"
+#include <esp_timer.h>
+
+#include "MycilaDimmerTrace.h"
+
+#include "priv/dimmer_registry.h"
+#include "priv/gpio_mask.h"
+#include "priv/timer_service.h"
+#include "priv/triple_buffer.h"
 
 #ifndef GPIO_IS_VALID_OUTPUT_GPIO
   #define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num >= 0) && \
@@ -30,17 +38,63 @@
                                         (((1ULL << (gpio_num)) & SOC_GPIO_VALID_GPIO_MASK) != 0))
 #endif
 
+// Software PLL locking the firing timer on the ZC events when onZeroCross() is used:
+// - the ZC ISR only timestamps the ZC events: the PLL runs in the firing ISR, which owns all the firing state
+// - the phase error is the time between the last ZC event and the closest timer alarm
+// - the estimated semi-period integrates the phase error (frequency tracking), with a sub-us resolution (Q16.16)
+// - at each semi-period with a new ZC event, the next timer event is corrected by the fractional difference between the estimated and timer semi-periods, plus a part of the phase error
+#define PLL_LOCK_RANGE_US   500 // larger phase errors (startup, missed ZC events): the timer is snapped on the ZC event
+#define PLL_PHASE_SHIFT     2   // 1/4 of the phase error is corrected at each new ZC event
+#define PLL_FREQUENCY_SHIFT 6   // 1/64 of the phase error is integrated in the estimated semi-period
+#define PLL_RANGE_DIVIDER   20  // the estimated semi-period is kept within ±5% of the configured one
+
 #define TAG "CycleStealing"
 
-static gptimer_handle_t fire_timer = nullptr;
-static bool inside_isr = false; // Re-entry guard: only accessed from _fireTimerISR, no volatile needed
-static uint16_t alarm_set = 0;  // Remember if the alarm is set or not, and if yes, to which value
+// events of the firing ISR on the shared firing timer: one per semi-period
+static Mycila::TimerService::Client timer_client;
+static bool inside_isr = false; // Re-entry guard: only accessed from _fireTimerISR, which is only called by the timer ISR: no volatile needed
+static uint16_t alarm_set = 0;  // Remember if the events are scheduled or not, and if yes, every how many us
+static uint64_t next_alarm = 0; // timer count of the next semi-period: written from task context when the events are (re)started, then only by _fireTimerISR
 
 #ifndef MYCILA_DIMMER_NO_LOCK
-static portMUX_TYPE dimmers_spinlock = portMUX_INITIALIZER_UNLOCKED;
+// only taken from task context to serialize the state updates: the ISR never locks
+static std::mutex dimmers_mutex;
 #endif
 
-Mycila::CycleStealingDimmer::RegisteredDimmer* Mycila::CycleStealingDimmer::dimmers = nullptr;
+// registered dimmers: only accessed from task context, under the lock
+static Mycila::DimmerRegistry<Mycila::CycleStealingDimmer, MYCILA_DIMMER_MAX_CYCLE_STEALING> dimmers;
+
+// what the ISR needs to know about the registered dimmers (structure of arrays) to decide whether to conduct or not
+struct DimmerStates {
+    Mycila::CycleStealingDimmer* dimmers[MYCILA_DIMMER_MAX_CYCLE_STEALING]; // owners of the ISR-only cycle stealing state
+    gpio_num_t pins[MYCILA_DIMMER_MAX_CYCLE_STEALING];
+    uint16_t duty_milli[MYCILA_DIMMER_MAX_CYCLE_STEALING];
+    Mycila::Ramp ramps[MYCILA_DIMMER_MAX_CYCLE_STEALING]; // duty_milli ramps, advanced by the ISR at each semi-period
+    uint16_t size = 0;
+    bool interleaved = false;
+    uint32_t sequence = 0;
+};
+
+// states are built from task context and published to the ISR, which picks the latest one at each semi-period
+static Mycila::TripleBuffer<DimmerStates> states;
+static uint32_t states_sequence = 0; // sequence number of the last published states: only accessed from task context, under the lock
+static bool interleaved = false;     // interleaving mode to publish: only accessed from task context, under the lock
+
+// last ZC event received by onZeroCross() (low 32 bits of its timer count): only written by the ZC ISR, and used by the PLL
+static std::atomic<uint32_t> zc_time = {0};
+
+// PLL state: only written by _fireTimerISR
+static uint32_t pll_zc_time = 0;              // last ZC event used by the PLL
+static uint32_t pll_event = 0;                // previous timer event (low 32 bits)
+static uint16_t pll_nominal = 0;              // semi-period the PLL was started from
+static std::atomic<int32_t> pll_period = {0}; // estimated semi-period, Q16.16
+static int32_t pll_fraction = 0;              // correction not yet applied to the timer count, Q16.16
+static int32_t interleave_error = 0; // global sigma-delta accumulator of the interleaving mode, scaled x1000: only accessed from _fireTimerISR
+
+// written by the firing ISR, read from task context
+static std::atomic<uint32_t> semi_period_count = {0};
+static std::atomic<uint32_t> applied_sequence = {0};
+static std::atomic<uint32_t> applied_semi_period = {0};
 
 bool Mycila::CycleStealingDimmer::begin() {
   if (_enabled)
@@ -55,11 +109,12 @@ bool Mycila::CycleStealingDimmer::begin() {
 
   pinMode(_pin, OUTPUT);
   digitalWrite(_pin, LOW);
-  _registerDimmer(this);
+  if (!_registerDimmer(this))
+    return false;
   _enabled = true;
 
   // restart with last saved value
-  setDutyCycle(_dutyCycle);
+  setDutyCycleRaw(_dutyCycleRaw);
   return true;
 }
 
@@ -74,183 +129,355 @@ void Mycila::CycleStealingDimmer::end() {
   digitalWrite(_pin, LOW);
 }
 
-void ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::onZeroCross(int16_t delayUntilZero, void* args) {
-  // read the timer count to check how much it diverted from the expected semi-period, and adjust it to stay in sync with the grid frequency
-  // We allow a margin of 50us from the onZeroCross event.
-  // delayUntilZero == 150us by default
-  // ------ 50us -- onZeroCross --- 50us --- 100us --- 0V crossing ------
-  uint64_t timer_count;
-  if (inlined_gptimer_get_raw_count(fire_timer, &timer_count) != ESP_OK) {
-    // failed to get the timer count: just ignore this ZC event
-    return;
-  }
+bool Mycila::CycleStealingDimmer::rampTo(float dutyCycle, uint32_t durationMs) {
+  if (!isOnline() || durationMs == 0 || _semiPeriod == 0)
+    return setDutyCycle(dutyCycle);
+
+  // start from the current duty cycle of the ISR if a ramp is ongoing
+  _rampFrom = _rampState.running(_ramp) ? _rampState.value : static_cast<int32_t>(duty_milli) << 16;
+  _rampSemiPeriods = static_cast<uint64_t>(durationMs) * 1000 / _semiPeriod;
+  _rampRequested = true;
+  const bool applied = setDutyCycle(dutyCycle);
+  _rampRequested = false;
+  return applied;
+}
 
-  // should not occur, but just in case...
-  if (timer_count > _semiPeriod) {
-    inlined_gptimer_set_raw_count(fire_timer, _semiPeriod);
+void ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::onZeroCross([[maybe_unused]] int16_t delayUntilZero, void* /* args */) {
+  uint64_t zcTime;
+  // failed to get the timer count: not started yet (no dimmer): just ignore this ZC event
+  if (!TimerService::now(zcTime))
     return;
-  }
+#ifdef MYCILA_DIMMER_TRACE
+  DimmerTrace::record(DimmerTrace::Type::ZC, DimmerTrace::Source::CYCLE_STEALING, zcTime, delayUntilZero);
+#endif
+  _onZeroCross(zcTime);
+}
 
-  // the timer alarm was triggered less than 50us ago
-  // => we allow a 50us margin of error
-  if (timer_count <= 50) {
-    return;
+// ZC event of the default ZCD fanned out by the shared timer
+void ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::_zeroCrossISR(void* /* arg */, [[maybe_unused]] int16_t delayUntilZero, uint64_t zcTime) {
+#ifdef MYCILA_DIMMER_TRACE
+  DimmerTrace::record(DimmerTrace::Type::ZC, DimmerTrace::Source::CYCLE_STEALING, zcTime, delayUntilZero);
+#endif
+  _onZeroCross(zcTime);
+}
+
+void ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::_onZeroCross(uint64_t zcTime) {
+#ifdef MYCILA_DIMMER_STATS
+  _stats.zcEvents++;
+#endif
+  // the firing ISR locks the timer events on the last ZC event at its next semi-period: the ZC ISR never touches the firing state
+  zc_time.store(static_cast<uint32_t>(zcTime), std::memory_order_relaxed);
+}
+
+// PLL: lock the timer events on the last ZC event received by onZeroCross(), called from _fireTimerISR() at each semi-period.
+// event is the expected timer count of the current semi-period: returns the number of ticks to move the next one by.
+int64_t ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::_pllCorrection(uint64_t event, uint16_t semiPeriod) {
+  const uint32_t previous = pll_event;
+  pll_event = static_cast<uint32_t>(event);
+
+  // the PLL works in Q16.16, so it requires a semi-period below 32768 us
+  if (semiPeriod >= 32768)
+    return 0;
+
+  // (re)start the PLL from the configured semi-period
+  if (pll_nominal != semiPeriod) {
+    pll_nominal = semiPeriod;
+    pll_period.store(static_cast<int32_t>(semiPeriod) << 16, std::memory_order_relaxed);
+    pll_fraction = 0;
   }
 
-  const uint16_t delayUntilAlarm = _semiPeriod - static_cast<uint16_t>(timer_count);
+  // the timer events are scheduled every semi-period: advance the next one by the difference with the estimated semi-period
+  const int32_t nominal = static_cast<int32_t>(semiPeriod) << 16;
+  pll_fraction += nominal - pll_period.load(std::memory_order_relaxed);
+
+  // new ZC event since the last semi-period: lock on it (otherwise, or without ZCD calling onZeroCross(), the events keep the estimated semi-period)
+  const uint32_t zc = zc_time.load(std::memory_order_relaxed);
+  if (zc != pll_zc_time) {
+    pll_zc_time = zc;
+
+    // phase error in us, between the ZC event and the closest timer event (this one, or the previous one when the ZC event was received just after it):
+    // > 0 if the timer event fired before the ZC event, < 0 if it fires after it
+    const int32_t to_current = static_cast<int32_t>(zc - static_cast<uint32_t>(event));
+    const int32_t to_previous = static_cast<int32_t>(zc - previous);
+    const int32_t phase_error = ((to_previous > 0 && to_previous < -to_current) ? to_previous : to_current) / static_cast<int32_t>(TimerService::TICKS_PER_US);
+
+    // a ZC event older than the previous timer event should not occur: just ignore it
+    if (phase_error <= static_cast<int32_t>(semiPeriod) && phase_error >= -static_cast<int32_t>(semiPeriod)) {
+#ifdef MYCILA_DIMMER_STATS
+      _stats.firingError.record(static_cast<uint32_t>(phase_error < 0 ? -phase_error : phase_error));
+#endif
 
-  // the timer alarm will trigger in less than 50us
-  if (delayUntilAlarm <= 50) {
-    return;
+      // out of lock (startup, missed ZC events): snap the timer events on the ZC event
+      if (phase_error > PLL_LOCK_RANGE_US || phase_error < -PLL_LOCK_RANGE_US)
+        return static_cast<int64_t>(phase_error) * TimerService::TICKS_PER_US;
+
+      // frequency tracking: the semi-period is too short when the alarm fires before the ZC event
+      int32_t estimated = pll_period.load(std::memory_order_relaxed) + phase_error * (65536 >> PLL_FREQUENCY_SHIFT);
+      if (estimated > nominal + nominal / PLL_RANGE_DIVIDER)
+        estimated = nominal + nominal / PLL_RANGE_DIVIDER;
+      else if (estimated < nominal - nominal / PLL_RANGE_DIVIDER)
+        estimated = nominal - nominal / PLL_RANGE_DIVIDER;
+      pll_period.store(estimated, std::memory_order_relaxed);
+
+      // delay the next event by a part of the phase error
+      pll_fraction -= phase_error * (65536 >> PLL_PHASE_SHIFT);
+    }
   }
 
-  // reprogram the timer alarm
-  inlined_gptimer_set_raw_count(fire_timer, _semiPeriod);
+  // the next event is only moved when the correction reaches 1 us
+  const int32_t correction = (pll_fraction + 0x8000) >> 16;
+  pll_fraction -= correction * 65536;
+  return -static_cast<int64_t>(correction) * TimerService::TICKS_PER_US;
 }
 
-// Timer ISR to be called as soon as a dimmer needs to be fired
-bool ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::_fireTimerISR(gptimer_handle_t timer, const gptimer_alarm_event_data_t* event, void* arg) {
+// Shared timer event: called at each semi-period to decide which dimmers conduct
+void ARDUINO_ISR_ATTR Mycila::CycleStealingDimmer::_fireTimerISR(void* /* arg */) {
   // Prevent re-entry: if this ISR takes longer than the timer period,
   // we must not allow concurrent execution which could cause race conditions
   if (inside_isr) {
     // ISR is already running - skip this alarm to prevent re-entry
-    return false;
+#ifdef MYCILA_DIMMER_STATS
+    _stats.isrReentries++;
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+    DimmerTrace::record(DimmerTrace::Type::SKIP, DimmerTrace::Source::CYCLE_STEALING, next_alarm, 0);
+#endif
+    return;
   }
   inside_isr = true;
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  // lock since we need to iterate over the list of dimmers
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
+  uint64_t isr_start = 0;
+  if (!TimerService::now(isr_start)) {
+#ifdef MYCILA_DIMMER_STATS
+    _stats.timerErrors++;
 #endif
+  }
+
+  // schedule the next semi-period from the expected time of this one, so that the ISR latency does not accumulate, locked on the ZC events by the PLL
+  const uint64_t period_ticks = static_cast<uint64_t>(alarm_set) * TimerService::TICKS_PER_US;
+  if (period_ticks) {
+    next_alarm += _pllCorrection(next_alarm, alarm_set) + period_ticks;
+    // more than a semi-period late (or events restarted): restart from now
+    if (!TimerService::schedule(timer_client, next_alarm)) {
+      next_alarm = isr_start + period_ticks;
+      TimerService::schedule(timer_client, next_alarm);
+    }
+  }
+
+  // start using the latest states published from task context
+  const DimmerStates& current = states.acquire();
+
+  // keep track of the semi-period from which new states are used
+  const uint32_t semi_period = semi_period_count.load(std::memory_order_relaxed) + 1;
+  semi_period_count.store(semi_period, std::memory_order_relaxed);
+  if (current.sequence != applied_sequence.load(std::memory_order_relaxed)) {
+    applied_semi_period.store(semi_period, std::memory_order_relaxed);
+    applied_sequence.store(current.sequence, std::memory_order_relaxed);
+  }
 
   // Semi-period cycle stealing with balanced control
   // Each semi-period (10ms for 50Hz), we decide whether to conduct or not
   // To avoid DC components, we must balance positive and negative half-cycles
 
-  struct RegisteredDimmer* current = dimmers;
-  while (current != nullptr) {
-    CycleStealingDimmer* dimmer = current->dimmer;
-
-    // duty_milli is 0–1000 (scaled ×1000 from 0.0–1.0), pre-computed in _apply()
-    // so that _fireTimerISR contains no floating-point instructions and the CPU
-    // does not need to save/restore the FP coprocessor state on the ISR stack (~72 bytes).
-    const uint16_t dutyCycle = current->dimmer->duty_milli;
-
-    // Full power: always conduct
-    if (dutyCycle >= 1000) {
-      gpio_ll_set_level(&GPIO, dimmer->_pin, HIGH);
-      current->dimmer->semi_period_odd = !current->dimmer->semi_period_odd;
-      current = current->next;
-      continue;
-    }
-
-    // Zero power: never conduct
-    if (dutyCycle == 0) {
-      gpio_ll_set_level(&GPIO, dimmer->_pin, LOW);
-      current->dimmer->semi_period_odd = !current->dimmer->semi_period_odd;
-      current = current->next;
-      continue;
-    }
+  // decisions are collected and applied to all the dimmers at once at the end
+  Mycila::GPIOMask conduct;
+  Mycila::GPIOMask block;
+
+  if (current.interleaved) {
+    // Interleaved mode: a global sigma-delta over the sum of the duty cycles gives the number of dimmers which have to conduct during this semi-period.
+    // The dimmers the most behind their own duty cycle (highest density_error) and allowed by their DC balance are picked first,
+    // so that the conduction is spread across the dimmers and the total load stays as flat as possible from a semi-period to the next.
+    uint16_t candidates[MYCILA_DIMMER_MAX_CYCLE_STEALING];
+    uint16_t candidate_count = 0;
+    int32_t conducting = 0;
+
+    for (uint16_t i = 0; i < current.size; i++) {
+      CycleStealingDimmer* dimmer = current.dimmers[i];
+      const gpio_num_t pin = current.pins[i];
+      const uint16_t dutyCycle = current.ramps[i].active() ? dimmer->_rampState.advance(current.ramps[i]) : current.duty_milli[i];
+
+      interleave_error += dutyCycle;
+
+      // Full power: always conduct
+      if (dutyCycle >= 1000) {
+        conduct.add(pin);
+        conducting++;
+        dimmer->semi_period_odd = !dimmer->semi_period_odd;
+        continue;
+      }
 
-    // Cycle stealing algorithm with DC balance
-    // Sliding window approach (Bresenham) with polarity balancing
+      // Zero power: never conduct
+      if (dutyCycle == 0) {
+        block.add(pin);
+        dimmer->semi_period_odd = !dimmer->semi_period_odd;
+        continue;
+      }
 
-    // Accumulate the energy deficit
-    current->dimmer->density_error += static_cast<int32_t>(dutyCycle);
+      dimmer->density_error += static_cast<int32_t>(dutyCycle);
 
-    bool should_conduct = false;
+      // same DC balance rule as the default mode
+      const int8_t phase_val = dimmer->semi_period_odd ? 1 : -1;
+      const bool helps_balance = (dimmer->dc_balance == 0) ||
+                                 (dimmer->dc_balance > 0 && phase_val < 0) ||
+                                 (dimmer->dc_balance < 0 && phase_val > 0);
 
-    // Check if we have enough accumulated error to fire a pulse
-    if (current->dimmer->density_error >= 1000) {
-      // We want to fire. Check DC balance constraints.
-      // semi_period_odd: True (Odd/Positive), False (Even/Negative)
-      // dc_balance: 0 (Balanced), >0 (Excess Positive), <0 (Excess Negative)
-      // Optimization: We define Odd as Positive (+1) and Even as Negative (-1)
-      int8_t phase_val = current->dimmer->semi_period_odd ? 1 : -1;
+      if (dimmer->density_error <= 0 || !helps_balance) {
+        block.add(pin);
+        dimmer->semi_period_odd = !dimmer->semi_period_odd;
+        continue;
+      }
 
-      // Rule:
-      // 1. If balanced (0), we can fire. We will create a debt.
-      // 2. If unbalanced, we can ONLY fire if it reduces the imbalance (opposite sign).
+      // candidates are sorted by density_error, highest first
+      uint16_t j = candidate_count++;
+      while (j > 0 && current.dimmers[candidates[j - 1]]->density_error < dimmer->density_error) {
+        candidates[j] = candidates[j - 1];
+        j--;
+      }
+      candidates[j] = i;
+    }
 
-      bool helps_balance = (current->dimmer->dc_balance == 0) ||
-                           (current->dimmer->dc_balance > 0 && phase_val < 0) ||
-                           (current->dimmer->dc_balance < 0 && phase_val > 0);
+    // remaining conduction slots after the dimmers at full power
+    const int32_t slots = interleave_error / 1000 - conducting;
 
-      if (helps_balance) {
-        should_conduct = true;
-        current->dimmer->dc_balance += phase_val;
-        current->dimmer->density_error -= 1000;
+    for (uint16_t c = 0; c < candidate_count; c++) {
+      CycleStealingDimmer* dimmer = current.dimmers[candidates[c]];
+      if (c < slots) {
+        conduct.add(current.pins[candidates[c]]);
+        conducting++;
+        dimmer->dc_balance += dimmer->semi_period_odd ? 1 : -1;
+        dimmer->density_error -= 1000;
       } else {
-        // We need to fire for power, but it would worsen the DC imbalance.
-        // Wait for the next semi-period (which will have opposite polarity).
-        should_conduct = false;
+        block.add(current.pins[candidates[c]]);
       }
+      dimmer->semi_period_odd = !dimmer->semi_period_odd;
     }
 
-    // Apply the decision
-    gpio_ll_set_level(&GPIO, dimmer->_pin, should_conduct ? HIGH : LOW);
-    current->dimmer->semi_period_odd = !current->dimmer->semi_period_odd;
+    interleave_error -= conducting * 1000;
 
-    current = current->next;
+    // anti-windup: slots which cannot be used because of the DC balance are only delayed, not accumulated forever
+    const int32_t limit = 1000 * static_cast<int32_t>(current.size);
+    if (interleave_error > limit)
+      interleave_error = limit;
+    else if (interleave_error < -limit)
+      interleave_error = -limit;
+
+  } else {
+    for (uint16_t i = 0; i < current.size; i++) {
+      CycleStealingDimmer* dimmer = current.dimmers[i];
+      const gpio_num_t pin = current.pins[i];
+
+      // duty_milli is 0–1000 (scaled ×1000 from 0.0–1.0), pre-computed in _apply()
+      // so that _fireTimerISR contains no floating-point instructions and the CPU
+      // does not need to save/restore the FP coprocessor state on the ISR stack (~72 bytes).
+      // A ramping dimmer gets its duty cycle from the ramp, in fixed-point.
+      const uint16_t dutyCycle = current.ramps[i].active() ? dimmer->_rampState.advance(current.ramps[i]) : current.duty_milli[i];
+
+      // Full power: always conduct
+      if (dutyCycle >= 1000) {
+        conduct.add(pin);
+        dimmer->semi_period_odd = !dimmer->semi_period_odd;
+        continue;
+      }
+
+      // Zero power: never conduct
+      if (dutyCycle == 0) {
+        block.add(pin);
+        dimmer->semi_period_odd = !dimmer->semi_period_odd;
+        continue;
+      }
+
+      // Cycle stealing algorithm with DC balance
+      // Sliding window approach (Bresenham) with polarity balancing
+
+      // Accumulate the energy deficit
+      dimmer->density_error += static_cast<int32_t>(dutyCycle);
+
+      bool should_conduct = false;
+
+      // Check if we have enough accumulated error to fire a pulse
+      if (dimmer->density_error >= 1000) {
+        // We want to fire. Check DC balance constraints.
+        // semi_period_odd: True (Odd/Positive), False (Even/Negative)
+        // dc_balance: 0 (Balanced), >0 (Excess Positive), <0 (Excess Negative)
+        // Optimization: We define Odd as Positive (+1) and Even as Negative (-1)
+        int8_t phase_val = dimmer->semi_period_odd ? 1 : -1;
+
+        // Rule:
+        // 1. If balanced (0), we can fire. We will create a debt.
+        // 2. If unbalanced, we can ONLY fire if it reduces the imbalance (opposite sign).
+
+        bool helps_balance = (dimmer->dc_balance == 0) ||
+                             (dimmer->dc_balance > 0 && phase_val < 0) ||
+                             (dimmer->dc_balance < 0 && phase_val > 0);
+
+        if (helps_balance) {
+          should_conduct = true;
+          dimmer->dc_balance += phase_val;
+          dimmer->density_error -= 1000;
+        } else {
+          // We need to fire for power, but it would worsen the DC imbalance.
+          // Wait for the next semi-period (which will have opposite polarity).
+          should_conduct = false;
+        }
+      }
+
+      // Record the decision
+      if (should_conduct)
+        conduct.add(pin);
+      else
+        block.add(pin);
+      dimmer->semi_period_odd = !dimmer->semi_period_odd;
+    }
   }
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  // unlock the list of dimmers
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+  // Apply the decisions
+  block.setLow();
+  conduct.setHigh();
+
+#ifdef MYCILA_DIMMER_TRACE
+  if (!conduct.empty())
+    DimmerTrace::record(DimmerTrace::Type::FIRE, DimmerTrace::Source::CYCLE_STEALING, isr_start, 0, conduct);
+  if (!block.empty())
+    DimmerTrace::record(DimmerTrace::Type::SKIP, DimmerTrace::Source::CYCLE_STEALING, isr_start, 0, block);
+#endif
+
+#ifdef MYCILA_DIMMER_STATS
+  uint64_t isr_end = 0;
+  if (TimerService::now(isr_end) && isr_end >= isr_start)
+    _stats.isrTime.record(static_cast<uint32_t>(isr_end - isr_start) / TimerService::TICKS_PER_US);
 #endif
 
   inside_isr = false;
-  return false;
 }
 
 // add a dimmer to the list of managed dimmers
-void Mycila::CycleStealingDimmer::_registerDimmer(Mycila::CycleStealingDimmer* dimmer) {
-  if (dimmers == nullptr) {
-    ESP_LOGI(TAG, "Starting dimmer firing ISR");
-
-    gptimer_config_t timer_config;
-    timer_config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
-    timer_config.direction = GPTIMER_COUNT_UP;
-    timer_config.resolution_hz = 1000000; // 1MHz resolution
-    timer_config.flags.intr_shared = true;
-    timer_config.intr_priority = 0;
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
-    timer_config.flags.backup_before_sleep = false;
-#endif
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
-    timer_config.flags.allow_pd = false;
+bool Mycila::CycleStealingDimmer::_registerDimmer(Mycila::CycleStealingDimmer* dimmer) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(dimmers_mutex);
 #endif
 
-    gptimer_event_callbacks_t callbacks_config;
-    callbacks_config.on_alarm = _fireTimerISR;
+  if (dimmers.full()) {
+    ESP_LOGE(TAG, "Unable to register dimmer on pin %d: maximum of %d dimmers reached", dimmer->getPin(), MYCILA_DIMMER_MAX_CYCLE_STEALING);
+    return false;
+  }
+
+  if (dimmers.empty()) {
+    ESP_LOGI(TAG, "Starting dimmer firing ISR");
+    Mycila::TimerService::checkISR("CycleStealingDimmer::onZeroCross()", reinterpret_cast<const void*>(&onZeroCross));
 
-    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &fire_timer));
-    ESP_ERROR_CHECK(gptimer_register_event_callbacks(fire_timer, &callbacks_config, nullptr));
-    ESP_ERROR_CHECK(gptimer_enable(fire_timer));
-    ESP_ERROR_CHECK(gptimer_start(fire_timer));
+    // cycle stealing dimmers also listen to the ZC events fanned out by Dimmers::onZeroCross()
+    timer_client.onEvent = _fireTimerISR;
+    timer_client.onZeroCross = _zeroCrossISR;
+    if (!Mycila::TimerService::attach(timer_client))
+      return false;
   }
 
   ESP_LOGD(TAG, "Register new dimmer %p on pin %d", dimmer, dimmer->getPin());
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
-#endif
-
-  if (dimmers == nullptr) {
-    dimmers = new RegisteredDimmer();
-    dimmers->dimmer = dimmer;
-  } else {
-    struct RegisteredDimmer* additional = new RegisteredDimmer();
-    additional->dimmer = dimmer;
-    additional->next = dimmers;
-    additional->prev = nullptr;
-    dimmers->prev = additional;
-    dimmers = additional;
-  }
+  dimmers.add(dimmer);
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
-#endif
+  _publishStates();
+  return true;
 }
 
 // remove a dimmer from the list of managed dimmers
@@ -258,66 +485,99 @@ void Mycila::CycleStealingDimmer::_unregisterDimmer(Mycila::CycleStealingDimmer*
   ESP_LOGD(TAG, "Unregister dimmer %p on pin %d", dimmer, dimmer->getPin());
 
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
+  std::unique_lock<std::mutex> lock(dimmers_mutex);
 #endif
 
-  struct RegisteredDimmer* current = dimmers;
-  while (current != nullptr) {
-    if (current->dimmer == dimmer) {
-      if (current->prev != nullptr) {
-        current->prev->next = current->next;
-      } else {
-        dimmers = current->next;
-      }
-      if (current->next != nullptr) {
-        current->next->prev = current->prev;
-      }
-      delete current;
-      break;
+  dimmers.remove(dimmer);
+
+  _publishStates();
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+  lock.unlock();
+#endif
+
+  // The ISR updates the cycle stealing state of the dimmers it knows about, so the dimmer cannot be released before the ISR has picked up the new states.
+  // The ISR always picks the latest states before starting, so we only need to wait if it is running (alarm set).
+  if (alarm_set) {
+    const int64_t timeout = 2 * static_cast<int64_t>(alarm_set);
+    const int64_t start = esp_timer_get_time();
+    while (!states.consumed() && esp_timer_get_time() - start < timeout) {
+      vTaskDelay(1);
     }
-    current = current->next;
   }
 
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+  lock.lock();
 #endif
 
-  if (dimmers == nullptr) {
+  if (dimmers.empty()) {
     ESP_LOGI(TAG, "Stopping dimmer firing ISR");
-    gptimer_stop(fire_timer);
-    ESP_ERROR_CHECK(gptimer_disable(fire_timer));
-    ESP_ERROR_CHECK(gptimer_del_timer(fire_timer));
-    fire_timer = nullptr;
+    alarm_set = 0;
+    Mycila::TimerService::detach(timer_client);
   }
 }
 
+// build and publish the states to be used by the ISR at the next semi-period: caller must hold the lock
+void Mycila::CycleStealingDimmer::_publishStates() {
+  DimmerStates& next = states.back();
+  next.size = 0;
+  next.sequence = ++states_sequence;
+  next.interleaved = interleaved;
+
+  for (CycleStealingDimmer* dimmer : dimmers) {
+    dimmer->_sequence = states_sequence;
+    next.dimmers[next.size] = dimmer;
+    next.pins[next.size] = dimmer->_pin;
+    next.duty_milli[next.size] = dimmer->duty_milli;
+    next.ramps[next.size] = dimmer->isRamping() ? dimmer->_ramp : Mycila::Ramp();
+    next.size++;
+  }
+
+  states.publish();
+}
+
 bool Mycila::CycleStealingDimmer::_apply() {
   // Cache integer duty cycle for use in _fireTimerISR (avoids float arithmetic — and the
   // associated FP coprocessor context save — inside the ISR, saving ~72 bytes of ISR stack).
-  duty_milli = static_cast<uint16_t>(getDutyCycleFire() * 1000.0f + 0.5f);
+  duty_milli = _scaleRaw(getDutyCycleFireRaw(), 1000);
+
+  // a new ramp to the new duty cycle, or any other change which cancels the current ramp
+  if (_rampRequested) {
+    // ramp ids are never reused, so that the ISR restarts from the new start value
+    if (++_rampId == 0)
+      _rampId = 1;
+    _ramp.set(_rampId, _rampFrom, static_cast<int32_t>(duty_milli) << 16, _rampSemiPeriods);
+  } else {
+    _ramp = Ramp();
+  }
 
   if (!_enabled)
     return false;
 
-  // we have no semi-period (or we are disconnected) => make sure the alarm is disabled to not trigger ISR
+  // the states of all the dimmers will be published once at the end of the batch
+  if (_batching)
+    return true;
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(dimmers_mutex);
+#endif
+
+  _publishStates();
+
+  // we have no semi-period (or we are disconnected) => make sure the timer events are cancelled to not trigger ISR
   if (_semiPeriod == 0 && alarm_set) {
-    if (fire_timer != nullptr) {
-      ESP_LOGD(TAG, "Disable firing timer alarm");
-      ESP_ERROR_CHECK(gptimer_set_alarm_action(fire_timer, nullptr));
-    }
+    ESP_LOGD(TAG, "Cancel firing timer events");
     alarm_set = 0;
+    TimerService::cancel(timer_client);
 
-    // we have a semi-period to set and it's different from the current one => reset the alarm
+    // we have a semi-period to set and it's different from the current one => reschedule the events
   } else if (_semiPeriod > 0 && alarm_set != _semiPeriod) {
-    if (fire_timer != nullptr) {
-      ESP_LOGD(TAG, "Enable firing timer alarm to %" PRIu16 " us", _semiPeriod);
-      gptimer_alarm_config_t fire_timer_alarm_cfg = {
-        .alarm_count = _semiPeriod,
-        .reload_count = 0,
-        .flags = {.auto_reload_on_alarm = true}};
-      ESP_ERROR_CHECK(gptimer_set_raw_count(fire_timer, 0));
-      ESP_ERROR_CHECK(gptimer_set_alarm_action(fire_timer, &fire_timer_alarm_cfg));
+    uint64_t now;
+    if (TimerService::now(now)) {
+      ESP_LOGD(TAG, "Schedule firing timer events every %" PRIu16 " us", _semiPeriod);
       alarm_set = _semiPeriod;
+      next_alarm = now + static_cast<uint64_t>(_semiPeriod) * TimerService::TICKS_PER_US;
+      TimerService::schedule(timer_client, next_alarm, now);
     } else {
       alarm_set = 0;
     }
@@ -325,3 +585,28 @@ bool Mycila::CycleStealingDimmer::_apply() {
 
   return true;
 }
+
+// all the cycle stealing dimmers are driven by the same firing ISR and published together
+const void* Mycila::CycleStealingDimmer::_batchResource() const { return &states; }
+
+uint32_t Mycila::CycleStealingDimmer::getSemiPeriodCount() { return semi_period_count.load(std::memory_order_relaxed); }
+uint32_t Mycila::CycleStealingDimmer::getAppliedSequence() { return applied_sequence.load(std::memory_order_relaxed); }
+uint32_t Mycila::CycleStealingDimmer::getAppliedSemiPeriod() { return applied_semi_period.load(std::memory_order_relaxed); }
+
+void Mycila::CycleStealingDimmer::setInterleaved(bool enable) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(dimmers_mutex);
+#endif
+  if (interleaved == enable)
+    return;
+  ESP_LOGI(TAG, "%s interleaving", enable ? "Enable" : "Disable");
+  interleaved = enable;
+  _publishStates();
+}
+
+bool Mycila::CycleStealingDimmer::isInterleaved() { return interleaved; }
+
+float Mycila::CycleStealingDimmer::getTrackedSemiPeriod() {
+  const int32_t period = pll_period.load(std::memory_order_relaxed);
+  return period ? static_cast<float>(period) / 65536.0f : 0.0f;
+}
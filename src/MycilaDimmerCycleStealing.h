@@ -5,10 +5,17 @@
 #pragma once
 
 #include "MycilaDimmer.h"
-#include <driver/gptimer_types.h>
+#include "MycilaDimmerStats.h"
+
+#include "priv/ramp.h"
+
+// Maximum number of cycle stealing dimmers which can be registered at the same time
+#ifndef MYCILA_DIMMER_MAX_CYCLE_STEALING
+  #define MYCILA_DIMMER_MAX_CYCLE_STEALING 8
+#endif
 
 namespace Mycila {
-  class CycleStealingDimmer : public Dimmer {
+  class CycleStealingDimmer final : public Dimmer {
     public:
       virtual ~CycleStealingDimmer() { end(); }
 
@@ -38,6 +45,19 @@ namespace Mycila {
 
       const char* type() const override { return "cycle-stealing"; }
 
+      /**
+       * @brief Same as Dimmer::setDutyCycle(), statically dispatched when called on a CycleStealingDimmer (the class is final)
+       */
+      bool setDutyCycle(float dutyCycle) { return CycleStealingDimmer::setDutyCycleRaw(_toRaw(dutyCycle)); }
+
+      /**
+       * @brief Same as Dimmer::setDutyCycleRaw(), without any virtual call when called on a CycleStealingDimmer
+       */
+      bool setDutyCycleRaw(uint16_t dutyCycle) override {
+        _updateDutyCycleRaw(dutyCycle);
+        return Dimmer::isOnline() && CycleStealingDimmer::_apply();
+      }
+
       /**
        * Optional: Integration with a Zero-Cross Detection (ZCD) system
        *
@@ -55,9 +75,77 @@ namespace Mycila {
        *
        * - When using your own ISR with the RobotDyn ZCD,      you can call this method with delayUntilZero == 200 since the length of the ZCD pulse is about  400 us.
        * - When using your own ISR with the ZCd from Daniel S, you can call this method with delayUntilZero == 550 since the length of the ZCD pulse is about 1100 us.
+       *
+       * The firing timer is locked on the ZC events by a software PLL, which tracks the real semi-period with a sub-us resolution and corrects the timer smoothly.
        */
       static void onZeroCross(int16_t delayUntilZero, void* args);
 
+      /**
+       * @brief Get the semi-period in us tracked by the PLL from the ZC events (0 if onZeroCross() was never called)
+       */
+      static float getTrackedSemiPeriod();
+
+      /**
+       * @brief Spread the conduction of all the cycle stealing dimmers across the semi-periods (disabled by default).
+       *
+       * By default, each dimmer decides on its own: several dimmers with the same duty cycle conduct during the same semi-periods, and the total load jumps in large steps.
+       * When interleaved, a global sigma-delta over the sum of the duty cycles decides how many dimmers conduct at each semi-period,
+       * and the dimmers the most behind their own duty cycle are picked first. Each dimmer keeps its own duty cycle and DC balance.
+       * The total is computed on the duty cycles: the load is only perfectly flat when the dimmers drive similar loads.
+       */
+      static void setInterleaved(bool enable);
+
+      /**
+       * @brief Returns true if the conduction of the cycle stealing dimmers is interleaved
+       */
+      static bool isInterleaved();
+
+      /**
+       * @brief Get the number of semi-periods processed by the firing ISR
+       */
+      static uint32_t getSemiPeriodCount();
+
+      /**
+       * @brief Get the sequence number of the last dimmer states used by the firing ISR.
+       * @brief States are only swapped at the start of a semi-period, so each semi-period is decided with one consistent setpoint.
+       */
+      static uint32_t getAppliedSequence();
+
+      /**
+       * @brief Get the semi-period (see getSemiPeriodCount()) from which the firing ISR started to use the last applied states
+       */
+      static uint32_t getAppliedSemiPeriod();
+
+      /**
+       * @brief Get the sequence number of the states holding the last duty cycle applied to this dimmer
+       */
+      uint32_t getUpdateSequence() const { return _sequence; }
+
+      /**
+       * @brief Returns true once the firing ISR uses the last duty cycle applied to this dimmer (from semi-period getAppliedSemiPeriod() at the latest)
+       */
+      bool isUpdateApplied() const { return static_cast<int32_t>(getAppliedSequence() - _sequence) >= 0; }
+
+      /**
+       * @brief Ramp the duty cycle linearly from the current one to the target, advanced by the firing ISR at each semi-period.
+       * @brief The target is directly applied when the dimmer is offline or there is no semi-period.
+       */
+      bool rampTo(float dutyCycle, uint32_t durationMs) override;
+
+      bool isRamping() const override { return _ramp.active() && !_rampState.reached(_ramp); }
+
+#ifdef MYCILA_DIMMER_STATS
+      /**
+       * @brief Get the statistics of the ZC and firing ISRs, shared by all the cycle stealing dimmers
+       */
+      static const DimmerStats& getStats() { return _stats; }
+
+      /**
+       * @brief Reset the statistics of the ZC and firing ISRs
+       */
+      static void resetStats() { _stats = DimmerStats(); }
+#endif
+
 #ifdef MYCILA_JSON_SUPPORT
       /**
        * @brief Serialize Dimmer information to a JSON object
@@ -67,13 +155,25 @@ namespace Mycila {
       void toJson(const JsonObject& root) const override {
         Dimmer::toJson(root);
         root["pin"] = _pin;
+#ifdef MYCILA_DIMMER_STATS
+        _stats.toJson(root["stats"].to<JsonObject>());
+#endif
       }
 #endif
 
+      void toSnapshot(DimmerSnapshot& snapshot) const override {
+        Dimmer::toSnapshot(snapshot);
+        snapshot.type = DimmerSnapshot::Type::CYCLE_STEALING;
+#ifdef MYCILA_DIMMER_STATS
+        snapshot.setStats(_stats);
+#endif
+      }
+
     protected:
       bool _apply() override;
+      const void* _batchResource() const override;
 
-      bool _calculateDimmerHarmonics(float* array, size_t n) const override {
+      bool _calculateDimmerHarmonics(float* array, size_t n, float duty) const override {
         // Unlike phase control (which distorts every cycle identically and creates standard odd harmonics like 3rd, 5th, 7th), cycle stealing creates sub-harmonics
         // and inter-harmonics (frequencies below 50/60Hz or between standard multiples).
         // Since the algorithm uses a dynamic Delta-Sigma modulator (Bresenham-like) rather than a fixed pattern length, the "period" of the repetition is not fixed
@@ -83,21 +183,30 @@ namespace Mycila {
 
     private:
       gpio_num_t _pin = GPIO_NUM_NC;
-      uint16_t duty_milli = 0; // Duty cycle scaled 0–1000; updated from _apply() (avoids float in ISR)
-      // Cycle stealing state tracking
+      uint16_t duty_milli = 0; // Duty cycle scaled 0–1000; updated from _apply() and published to the ISR (avoids float in ISR)
+      uint32_t _sequence = 0;  // sequence number of the published states holding duty_milli
+      // duty_milli ramp requested by rampTo()
+      Ramp _ramp;
+      RampState _rampState; // only written by the firing ISR
+      bool _rampRequested = false;
+      uint32_t _rampId = 0;
+      int32_t _rampFrom = 0;
+      uint32_t _rampSemiPeriods = 0;
+      // Cycle stealing state tracking (only accessed from the ISR once registered)
       bool semi_period_odd = false; // Track odd/even semi-periods for balance
       int32_t density_error = 0;    // Bresenham accumulator, scaled ×1000 (threshold: 1000)
       int8_t dc_balance = 0;        // DC component balance (-1: owes positive, 1: owes negative)
 
-      struct RegisteredDimmer {
-          CycleStealingDimmer* dimmer = nullptr;
-          RegisteredDimmer* prev = nullptr;
-          RegisteredDimmer* next = nullptr;
-      };
+#ifdef MYCILA_DIMMER_STATS
+      inline static DimmerStats _stats; // only updated from the ISRs
+#endif
 
-      static struct RegisteredDimmer* dimmers;
-      static bool _fireTimerISR(gptimer_handle_t timer, const gptimer_alarm_event_data_t* event, void* arg);
-      static void _registerDimmer(Mycila::CycleStealingDimmer* dimmer);
+      static void _fireTimerISR(void* arg);
+      static void _zeroCrossISR(void* arg, int16_t delayUntilZero, uint64_t zcTime);
+      static void _onZeroCross(uint64_t zcTime);
+      static int64_t _pllCorrection(uint64_t event, uint16_t semiPeriod);
+      static bool _registerDimmer(Mycila::CycleStealingDimmer* dimmer);
       static void _unregisterDimmer(Mycila::CycleStealingDimmer* dimmer);
+      static void _publishStates();
   };
 } // namespace Mycila
@@ -7,12 +7,109 @@
 // logging
 #include <esp32-hal-log.h>
 
+#include <mutex>
+
 #define TAG "DFRobot"
 
+// addresses 0x58 to 0x5F answering on each bus: shared by all the dimmers, so that a bus is only scanned once
+struct BusScan {
+    TwoWire* wire;
+    uint8_t found;   // bit n: device found @ 0x58 + n
+    uint8_t scanned; // bit n: 0x58 + n was probed
+};
+// always locked, whatever MYCILA_DIMMER_NO_LOCK: the asynchronous discoveries run in the I2C worker task
+static std::mutex scans_mutex;
+static BusScan scans[MYCILA_DIMMER_DFROBOT_MAX_BUSES];
+static size_t scan_count = 0;
+
+// caller must hold the scan lock
+static BusScan* getBusScan(TwoWire* wire) {
+  for (size_t i = 0; i < scan_count; i++)
+    if (scans[i].wire == wire)
+      return &scans[i];
+  if (scan_count >= MYCILA_DIMMER_DFROBOT_MAX_BUSES)
+    return nullptr;
+  scans[scan_count] = {.wire = wire, .found = 0, .scanned = 0};
+  return &scans[scan_count++];
+}
+
+void Mycila::DFRobotDimmer::clearDiscoveryCache() {
+  std::lock_guard<std::mutex> lock(scans_mutex);
+  scan_count = 0;
+}
+
 bool Mycila::DFRobotDimmer::begin() {
   if (_enabled)
     return true;
 
+  if (!_checkConfig() || !_discover())
+    return false;
+
+  // the worker can still be attached after a failed asynchronous discovery: it is reused
+  if (_async && !_workerAttached) {
+    _worker.onWrite = _workerWrite;
+    _worker.arg = this;
+    _sentDuty = -1;
+    _pendingDuty.store(-1);
+    _workerAttached = I2CWorker::attach(_worker);
+    if (!_workerAttached)
+      ESP_LOGW(TAG, "DFRobot @ 0x%02x: Unable to start asynchronous mode: duty cycles will be sent synchronously", _deviceAddress);
+  }
+
+  _enabled = true;
+
+  // restart with last saved value
+  setDutyCycleRaw(_dutyCycleRaw);
+
+  return true;
+}
+
+bool Mycila::DFRobotDimmer::beginAsync(BeginCallback callback, void* arg) {
+  if (_enabled || _discovering.load())
+    return true;
+
+  if (!_checkConfig())
+    return false;
+
+  _async = true;
+  _beginCallback = callback;
+  _beginCallbackArg = arg;
+  _pendingDuty.store(-1);
+  _discovering.store(true);
+
+  // the worker cannot detach itself when the discovery fails: it stays attached and is reused to retry the discovery
+  if (!_workerAttached) {
+    _worker.onWrite = _workerWrite;
+    _worker.arg = this;
+    _sentDuty = -1;
+    _workerAttached = I2CWorker::attach(_worker);
+    if (!_workerAttached) {
+      _discovering.store(false);
+      return false;
+    }
+  }
+
+  I2CWorker::notify(_worker);
+  return true;
+}
+
+void Mycila::DFRobotDimmer::end() {
+  // waits for the ongoing discovery or write
+  if (_workerAttached) {
+    I2CWorker::detach(_worker);
+    _workerAttached = false;
+    _discovering.store(false);
+  }
+  if (!_enabled)
+    return;
+  _enabled = false;
+  _online = false;
+  ESP_LOGI(TAG, "Disable DFRobot @ 0x%02x", _deviceAddress);
+  // the output is turned off synchronously, after the last asynchronous write
+  _apply();
+}
+
+bool Mycila::DFRobotDimmer::_checkConfig() {
   uint8_t resolution = getResolution();
   if (!resolution) {
     ESP_LOGE(TAG, "SKU not set!");
@@ -32,28 +129,58 @@ bool Mycila::DFRobotDimmer::begin() {
     return false;
   }
 
-  // discovery
+  return true;
+}
+
+// find the device (from the bus scan cache when possible) and set its output range
+bool Mycila::DFRobotDimmer::_discover() {
   bool found = false;
-  if (_deviceAddress) {
-    ESP_LOGI(TAG, "Searching for DFRobot @ 0x%02x...", _deviceAddress);
-    for (int i = 0; i < 3; i++) {
-      uint8_t err = _test(_deviceAddress);
-      if (err) {
-        ESP_LOGD(TAG, "DFRobot @ 0x%02x: TwoWire communication error: %d", _deviceAddress, err);
-        delay(10);
+  {
+    std::lock_guard<std::mutex> lock(scans_mutex);
+    BusScan* scan = getBusScan(_wire);
+
+    if (_deviceAddress) {
+      const uint8_t bit = _deviceAddress >= 0x58 && _deviceAddress <= 0x5F ? 1 << (_deviceAddress - 0x58) : 0;
+      if (scan != nullptr && (scan->scanned & bit)) {
+        found = scan->found & bit;
       } else {
-        found = true;
-        break;
+        ESP_LOGI(TAG, "Searching for DFRobot @ 0x%02x...", _deviceAddress);
+        for (int i = 0; i < 3; i++) {
+          uint8_t err = _test(_deviceAddress);
+          if (err) {
+            ESP_LOGD(TAG, "DFRobot @ 0x%02x: TwoWire communication error: %d", _deviceAddress, err);
+            delay(10);
+          } else {
+            found = true;
+            break;
+          }
+        }
+        if (scan != nullptr) {
+          scan->scanned |= bit;
+          if (found)
+            scan->found |= bit;
+        }
       }
-    }
 
-  } else {
-    ESP_LOGI(TAG, "Searching for DFRobot @ 0x58 up to 0x5F...");
-    for (uint8_t addr = 0x58; !found && addr <= 0x5F; addr++) {
-      if (_test(addr) == ESP_OK) {
-        _deviceAddress = addr;
-        found = true;
-        break;
+    } else {
+      uint8_t answering = 0;
+      if (scan != nullptr && scan->scanned == 0xFF) {
+        answering = scan->found;
+      } else {
+        ESP_LOGI(TAG, "Searching for DFRobot @ 0x58 up to 0x5F...");
+        for (uint8_t addr = 0x58; addr <= 0x5F; addr++)
+          if (_test(addr) == ESP_OK)
+            answering |= 1 << (addr - 0x58);
+        if (scan != nullptr) {
+          scan->found = answering;
+          scan->scanned = 0xFF;
+        }
+      }
+      for (uint8_t addr = 0x58; !found && addr <= 0x5F; addr++) {
+        if (answering & (1 << (addr - 0x58))) {
+          _deviceAddress = addr;
+          found = true;
+        }
       }
     }
   }
@@ -74,21 +201,131 @@ bool Mycila::DFRobotDimmer::begin() {
     return false;
   }
 
-  _enabled = true;
-
-  // restart with last saved value
-  setDutyCycle(_dutyCycle);
+  return true;
+}
 
+bool Mycila::DFRobotDimmer::bindSibling(DFRobotDimmer& sibling) {
+  if (&sibling == this || _sku != sibling._sku || _sku == SKU::DFR1071_GP8211S || !((_channel == 0 && sibling._channel == 1) || (_channel == 1 && sibling._channel == 0))) {
+    ESP_LOGE(TAG, "Unable to bind DFRobot channels %d and %d: both channels of a same 2-channel device are required", _channel, sibling._channel);
+    return false;
+  }
+  unbindSibling();
+  sibling.unbindSibling();
+  _sibling = &sibling;
+  sibling._sibling = this;
   return true;
 }
 
-void Mycila::DFRobotDimmer::end() {
-  if (!_enabled)
+void Mycila::DFRobotDimmer::unbindSibling() {
+  if (_sibling == nullptr)
     return;
-  _enabled = false;
-  _online = false;
-  ESP_LOGI(TAG, "Disable DFRobot @ 0x%02x", _deviceAddress);
-  _apply();
+  _sibling->_sibling = nullptr;
+  _sibling = nullptr;
+}
+
+// the sibling, if both channels can be written in one transaction
+Mycila::DFRobotDimmer* Mycila::DFRobotDimmer::_writableSibling() const {
+  if (_sibling == nullptr || !_enabled || !_sibling->_enabled)
+    return nullptr;
+  if (_sibling->_wire != _wire || _sibling->_deviceAddress != _deviceAddress || _sibling->_channel + _channel != 1 || _sibling->_workerAttached != _workerAttached)
+    return nullptr;
+  return _sibling;
+}
+
+bool Mycila::DFRobotDimmer::_apply() {
+  // sent with the sibling by _applyBatch()
+  if (_batching && _sibling != nullptr)
+    return true;
+
+  const uint16_t duty = _outputDuty();
+  if (_workerAttached) {
+    // the worker only sends the latest duty
+    _pendingDuty.store(duty);
+    I2CWorker::notify(_worker);
+    return true;
+  }
+  return _sendDutyCycle(_deviceAddress, duty) == ESP_OK;
+}
+
+// both channels of a device share the same resource: the one of channel 0
+const void* Mycila::DFRobotDimmer::_batchResource() const {
+  if (_sibling == nullptr)
+    return nullptr;
+  return _channel == 0 ? this : _sibling;
+}
+
+bool Mycila::DFRobotDimmer::_applyBatch() {
+  DFRobotDimmer* sibling = _writableSibling();
+  if (sibling == nullptr) {
+    bool success = _apply();
+    if (_sibling != nullptr && _sibling->isOnline())
+      success &= _sibling->_apply();
+    return success;
+  }
+
+  if (_workerAttached) {
+    // the worker merges both pending duties
+    _pendingDuty.store(_outputDuty());
+    sibling->_pendingDuty.store(sibling->_outputDuty());
+    I2CWorker::notify(_worker);
+    return true;
+  }
+
+  const DFRobotDimmer* channel0 = _channel == 0 ? this : sibling;
+  const DFRobotDimmer* channel1 = _channel == 0 ? sibling : this;
+  return _sendDutyCycles(_deviceAddress, channel0->_outputDuty(), channel1->_outputDuty()) == ESP_OK;
+}
+
+void Mycila::DFRobotDimmer::_workerWrite(void* arg) {
+  DFRobotDimmer* dimmer = static_cast<DFRobotDimmer*>(arg);
+
+  // asynchronous begin: the dimmer is enabled once found, and then sends its current duty
+  if (dimmer->_discovering.exchange(false)) {
+    const bool enabled = dimmer->_discover();
+    dimmer->_enabled = enabled;
+    if (enabled)
+      dimmer->_pendingDuty.store(dimmer->_outputDuty());
+    // called without the worker lock: the callback can call end(), or begin a dimmer
+    if (dimmer->_beginCallback != nullptr)
+      dimmer->_beginCallback(*dimmer, enabled, dimmer->_beginCallbackArg);
+    // not found, or ended by the callback
+    if (!enabled || !dimmer->_workerAttached)
+      return;
+  }
+  DFRobotDimmer* sibling = dimmer->_writableSibling();
+
+  // both channels changed: one transaction
+  if (sibling != nullptr && sibling->_pendingDuty.load() >= 0 && dimmer->_pendingDuty.load() >= 0) {
+    DFRobotDimmer* channel0 = dimmer->_channel == 0 ? dimmer : sibling;
+    DFRobotDimmer* channel1 = dimmer->_channel == 0 ? sibling : dimmer;
+    const int32_t duty0 = channel0->_pendingDuty.exchange(-1);
+    const int32_t duty1 = channel1->_pendingDuty.exchange(-1);
+    if (duty0 == channel0->_sentDuty && duty1 == channel1->_sentDuty)
+      return;
+    uint8_t err = dimmer->_sendDutyCycles(dimmer->_deviceAddress, duty0, duty1);
+    if (err) {
+      ESP_LOGD(TAG, "DFRobot @ 0x%02x: Unable to send duties %" PRId32 " and %" PRId32 ": TwoWire communication error: %d", dimmer->_deviceAddress, duty0, duty1, err);
+      // sent again with the next duty cycles
+      channel0->_sentDuty = -1;
+      channel1->_sentDuty = -1;
+      return;
+    }
+    channel0->_sentDuty = duty0;
+    channel1->_sentDuty = duty1;
+    return;
+  }
+
+  const int32_t duty = dimmer->_pendingDuty.exchange(-1);
+  if (duty < 0 || duty == dimmer->_sentDuty)
+    return;
+  uint8_t err = dimmer->_sendDutyCycle(dimmer->_deviceAddress, duty);
+  if (err) {
+    ESP_LOGD(TAG, "DFRobot @ 0x%02x: Unable to send duty %" PRId32 ": TwoWire communication error: %d", dimmer->_deviceAddress, duty, err);
+    // sent again with the next duty cycle
+    dimmer->_sentDuty = -1;
+    return;
+  }
+  dimmer->_sentDuty = duty;
 }
 
 uint8_t Mycila::DFRobotDimmer::_sendDutyCycle(uint8_t address, uint16_t duty) {
@@ -96,15 +333,15 @@ uint8_t Mycila::DFRobotDimmer::_sendDutyCycle(uint8_t address, uint16_t duty) {
   switch (_channel) {
     case 0: {
       uint8_t buffer[2] = {uint8_t(duty & 0xff), uint8_t(duty >> 8)};
-      return _send(address, 0x02, buffer, 2) == 0;
+      return _send(address, 0x02, buffer, 2);
     }
     case 1: {
       uint8_t buffer[2] = {uint8_t(duty & 0xff), uint8_t(duty >> 8)};
-      return _send(address, 0x04, buffer, 2) == 0;
+      return _send(address, 0x04, buffer, 2);
     }
     case 2: {
       uint8_t buffer[4] = {uint8_t(duty & 0xff), uint8_t(duty >> 8), uint8_t(duty & 0xff), uint8_t(duty >> 8)};
-      return _send(address, 0x02, buffer, 4) == 0;
+      return _send(address, 0x02, buffer, 4);
     }
     default:
       assert(false); // fail
@@ -112,6 +349,14 @@ uint8_t Mycila::DFRobotDimmer::_sendDutyCycle(uint8_t address, uint16_t duty) {
   }
 }
 
+// channels 0 and 1 in one auto-increment write, from register 0x02
+uint8_t Mycila::DFRobotDimmer::_sendDutyCycles(uint8_t address, uint16_t duty0, uint16_t duty1) {
+  duty0 = duty0 << (16 - getResolution());
+  duty1 = duty1 << (16 - getResolution());
+  uint8_t buffer[4] = {uint8_t(duty0 & 0xff), uint8_t(duty0 >> 8), uint8_t(duty1 & 0xff), uint8_t(duty1 >> 8)};
+  return _send(address, 0x02, buffer, 4);
+}
+
 uint8_t Mycila::DFRobotDimmer::_sendOutput(uint8_t address, Output output) {
   switch (output) {
     case Output::RANGE_0_5V: {
@@ -5,14 +5,22 @@
 #pragma once
 
 #include "MycilaDimmerPhaseControl.h"
+#include "priv/i2c_worker.h"
 
 #include <Wire.h>
 
+#include <atomic>
+
+// Maximum number of I2C buses whose DFRobot scan is cached (see DFRobotDimmer::clearDiscoveryCache())
+#ifndef MYCILA_DIMMER_DFROBOT_MAX_BUSES
+  #define MYCILA_DIMMER_DFROBOT_MAX_BUSES 2
+#endif
+
 namespace Mycila {
   /**
    * @brief DFRobot DFR1071/DFR1073/DFR0971 I2C controlled 0-10V/0-5V dimmer implementation for voltage regulators controlled by a 0-10V/0-5V analog signal
    */
-  class DFRobotDimmer : public PhaseControlDimmer {
+  class DFRobotDimmer final : public PhaseControlDimmer {
     public:
       enum class SKU {
         UNKNOWN,
@@ -29,7 +37,13 @@ namespace Mycila {
         RANGE_0_10V,
       };
 
-      virtual ~DFRobotDimmer() { end(); }
+      // called from the I2C worker task once the asynchronous discovery is done: enabled is false if the device could not be set up
+      typedef void (*BeginCallback)(DFRobotDimmer& dimmer, bool enabled, void* arg);
+
+      virtual ~DFRobotDimmer() {
+        end();
+        unbindSibling();
+      }
 
       void setWire(TwoWire& wire) { _wire = &wire; }
       TwoWire& getWire() const { return *_wire; }
@@ -61,6 +75,25 @@ namespace Mycila {
       void setChannel(uint8_t channel) { _channel = channel; }
       uint8_t getChannel() const { return _channel; }
 
+      /**
+       * @brief Send the duty cycles from a background task instead of the task calling setDutyCycle() (default: false)
+       * @n Only the latest duty cycle is sent, and the writes which would not change the output are skipped:
+       * setDutyCycle() never waits for the I2C bus, even when the device is unplugged.
+       * @warning Must be called before begin()
+       */
+      void setAsync(bool async) { _async = async; }
+      bool isAsync() const { return _async; }
+
+      /**
+       * @brief Bind the dimmer driving the other channel of the same 2-channel device (DFR1073 / DFR0971)
+       * @n The duty cycles of both channels updated in the same batch (see Dimmers::commit()) are then sent in one I2C transaction, so both outputs change together.
+       * @warning Both dimmers must use the same bus, SKU and address, on channels 0 and 1
+       * @return false if the dimmers cannot be bound
+       */
+      bool bindSibling(DFRobotDimmer& sibling);
+      void unbindSibling();
+      DFRobotDimmer* getSibling() const { return _sibling; }
+
       /**
        * @brief Get the PWM resolution in bits
        */
@@ -85,6 +118,23 @@ namespace Mycila {
        */
       bool begin() override;
 
+      /**
+       * @brief Enable the dimmer without waiting for the I2C discovery, which is done in the background by the I2C worker (implies setAsync(true))
+       * @n The dimmer is enabled (isEnabled(), isOnline()) once the device is found and set up, and then sends its current duty cycle.
+       * @n If the device is not found, beginAsync() or begin() can be called again to retry (the worker stays attached until end()).
+       * @param callback optional callback called from the I2C worker task when the discovery is done
+       * @warning The callback runs in the I2C worker task, which does not send the duty cycles of the other dimmers until it returns:
+       * it can call end() or begin another dimmer, but it must not block, and it must not wait for a task calling end() on a DFRobot dimmer.
+       * @return false if the configuration is invalid or if the worker cannot be started
+       */
+      bool beginAsync(BeginCallback callback = nullptr, void* arg = nullptr);
+
+      /**
+       * @brief Forget the devices found on the I2C buses: the next begin() scans the bus again
+       * @n Each bus is otherwise only scanned once, for all the DFRobot dimmers.
+       */
+      static void clearDiscoveryCache();
+
       /**
        * @brief Disable the dimmer
        *
@@ -94,6 +144,19 @@ namespace Mycila {
 
       const char* type() const override { return "dfrobot"; }
 
+      /**
+       * @brief Same as Dimmer::setDutyCycle(), statically dispatched when called on a DFRobotDimmer (the class is final)
+       */
+      bool setDutyCycle(float dutyCycle) { return DFRobotDimmer::setDutyCycleRaw(_toRaw(dutyCycle)); }
+
+      /**
+       * @brief Same as Dimmer::setDutyCycleRaw(), without any virtual call when called on a DFRobotDimmer
+       */
+      bool setDutyCycleRaw(uint16_t dutyCycle) override {
+        _updateDutyCycleRaw(dutyCycle);
+        return PhaseControlDimmer::isOnline() && DFRobotDimmer::_apply();
+      }
+
 #ifdef MYCILA_JSON_SUPPORT
       /**
        * @brief Serialize Dimmer information to a JSON object
@@ -112,23 +175,46 @@ namespace Mycila {
       }
 #endif
 
-    protected:
-      bool _apply() override {
-        if (!isOnline()) {
-          return _sendDutyCycle(_deviceAddress, 0) == ESP_OK;
-        }
-        uint16_t duty = getDutyCycleFire() * ((1 << getResolution()) - 1);
-        return _sendDutyCycle(_deviceAddress, duty) == ESP_OK;
+      void toSnapshot(DimmerSnapshot& snapshot) const override {
+        PhaseControlDimmer::toSnapshot(snapshot);
+        snapshot.type = DimmerSnapshot::Type::DFROBOT;
       }
 
+    protected:
+      bool _apply() override;
+      const void* _batchResource() const override;
+      bool _applyBatch() override;
+
     private:
       SKU _sku = SKU::UNKNOWN;
       Output _output = Output::RANGE_0_10V;
       TwoWire* _wire = &Wire;
       uint8_t _deviceAddress;
       uint8_t _channel = 0;
+      bool _async = false;
+
+      // asynchronous mode
+      I2CWorker::Client _worker;
+      bool _workerAttached = false;
+      std::atomic<int32_t> _pendingDuty{-1}; // -1: nothing to send
+      int32_t _sentDuty = -1;                 // -1: unknown output: only accessed by the worker
+
+      // other channel of the same device, see bindSibling()
+      DFRobotDimmer* _sibling = nullptr;
+
+      // asynchronous begin
+      std::atomic<bool> _discovering{false};
+      BeginCallback _beginCallback = nullptr;
+      void* _beginCallbackArg = nullptr;
+
+      static void _workerWrite(void* arg);
+      bool _checkConfig();
+      bool _discover();
+      uint16_t _outputDuty() const { return _scaleRaw(getDutyCycleFireRaw(), (1 << getResolution()) - 1); }
+      DFRobotDimmer* _writableSibling() const;
 
       uint8_t _sendDutyCycle(uint8_t address, uint16_t duty);
+      uint8_t _sendDutyCycles(uint8_t address, uint16_t duty0, uint16_t duty1);
       uint8_t _sendOutput(uint8_t address, Output output);
       uint8_t _send(uint8_t address, uint8_t reg, uint8_t* buffer, size_t size);
       uint8_t _test(uint8_t address);
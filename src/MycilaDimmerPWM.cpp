@@ -5,10 +5,13 @@
 #include <MycilaDimmerPWM.h>
 
 #include <driver/ledc.h>
+#include <soc/soc_caps.h>
 
 // logging
 #include <esp32-hal-log.h>
 
+#include <mutex>
+
 #ifndef GPIO_IS_VALID_OUTPUT_GPIO
   #define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num >= 0) && \
                                                (((1ULL << (gpio_num)) & SOC_GPIO_VALID_OUTPUT_GPIO_MASK) != 0))
@@ -21,6 +24,40 @@
 
 #define TAG "PWM"
 
+// The Arduino core sets LEDC channel n on timer (n / 2) % SOC_LEDC_TIMER_NUM: both channels of a pair share their timer,
+// so they must have the same frequency and resolution. The channels are allocated from the last one,
+// away from the channels given by ledcAttach() to the other LEDC users, which starts from the first one.
+#if SOC_LEDC_SUPPORT_HS_MODE
+  #define LEDC_CHANNEL_COUNT (SOC_LEDC_CHANNEL_NUM * 2)
+#else
+  #define LEDC_CHANNEL_COUNT SOC_LEDC_CHANNEL_NUM
+#endif
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+static std::mutex channels_mutex;
+#endif
+static Mycila::PWMDimmer* channels[LEDC_CHANNEL_COUNT] = {};
+
+// caller must hold the lock
+static int8_t allocateChannel(Mycila::PWMDimmer* dimmer) {
+  // share the timer of a dimmer with the same frequency and resolution
+  for (int8_t c = LEDC_CHANNEL_COUNT - 1; c >= 0; c--) {
+    const Mycila::PWMDimmer* pair = channels[c ^ 1];
+    if (channels[c] == nullptr && pair != nullptr && pair->getFrequency() == dimmer->getFrequency() && pair->getResolution() == dimmer->getResolution()) {
+      channels[c] = dimmer;
+      return c;
+    }
+  }
+  // or take a free timer
+  for (int8_t c = LEDC_CHANNEL_COUNT - 1; c >= 0; c--) {
+    if (channels[c] == nullptr && channels[c ^ 1] == nullptr) {
+      channels[c] = dimmer;
+      return c;
+    }
+  }
+  return -1;
+}
+
 bool Mycila::PWMDimmer::begin() {
   if (_enabled)
     return true;
@@ -35,15 +72,29 @@ bool Mycila::PWMDimmer::begin() {
   pinMode(_pin, OUTPUT);
   digitalWrite(_pin, LOW);
 
-  if (ledcAttach(_pin, _frequency, _resolution) && ledcWrite(_pin, 0)) {
-    _enabled = true;
-  } else {
-    ESP_LOGE(TAG, "Failed to attach ledc driver on pin %" PRId8, _pin);
-    return false;
+  {
+#ifndef MYCILA_DIMMER_NO_LOCK
+    std::lock_guard<std::mutex> lock(channels_mutex);
+#endif
+    _channel = allocateChannel(this);
+    if (_channel < 0) {
+      ESP_LOGE(TAG, "Failed to attach ledc driver on pin %" PRId8 ": no LEDC channel with a free or compatible timer", _pin);
+      return false;
+    }
+    if (ledcAttachChannel(_pin, _frequency, _resolution, _channel) && ledcWrite(_pin, 0)) {
+      _enabled = true;
+    } else {
+      ESP_LOGE(TAG, "Failed to attach ledc driver on pin %" PRId8, _pin);
+      channels[_channel] = nullptr;
+      _channel = -1;
+      return false;
+    }
   }
 
+  ESP_LOGD(TAG, "Dimmer on pin %" PRId8 " uses LEDC channel %" PRId8, _pin, _channel);
+
   // restart with last saved value
-  setDutyCycle(_dutyCycle);
+  setDutyCycleRaw(_dutyCycleRaw);
   return true;
 }
 
@@ -57,4 +108,61 @@ void Mycila::PWMDimmer::end() {
   ledcDetach(_pin);
   pinMode(_pin, OUTPUT);
   digitalWrite(_pin, LOW);
+  {
+#ifndef MYCILA_DIMMER_NO_LOCK
+    std::lock_guard<std::mutex> lock(channels_mutex);
+#endif
+    channels[_channel] = nullptr;
+    _channel = -1;
+  }
+}
+
+bool Mycila::PWMDimmer::fadeTo(float dutyCycle, uint32_t durationMs, FadeCallback callback, void* arg) {
+  if (!isOnline() || durationMs == 0)
+    return setDutyCycle(dutyCycle);
+
+  _fadeMs = durationMs;
+  _fadeCallback = callback;
+  _fadeCallbackArg = arg;
+  _fadeRequested = true;
+  const bool applied = setDutyCycle(dutyCycle);
+  _fadeRequested = false;
+  return applied;
+}
+
+bool Mycila::PWMDimmer::_apply() {
+  const uint32_t duty = _scaleRaw(getDutyCycleFireRaw(), (1UL << _resolution) - 1);
+
+  // a new duty cycle replaces the ongoing fade
+  _stopFade();
+
+  if (_fadeRequested) {
+    _fading = true;
+    if (ledcFadeWithInterruptArg(_pin, ledcRead(_pin), duty, _fadeMs, _fadeISR, this))
+      return true;
+    _fading = false;
+    ESP_LOGW(TAG, "Unable to fade dimmer on pin %" PRId8 ": duty cycle set immediately", _pin);
+  }
+
+  return ledcWrite(_pin, duty);
+}
+
+// LEDC fade ISR: the user callback is called in ISR context
+void ARDUINO_ISR_ATTR Mycila::PWMDimmer::_fadeISR(void* arg) {
+  PWMDimmer* dimmer = static_cast<PWMDimmer*>(arg);
+  // a stopped fade must not call the callback of the next one
+  if (!dimmer->_fading.exchange(false))
+    return;
+  if (dimmer->_fadeCallback != nullptr)
+    dimmer->_fadeCallback(*dimmer, dimmer->_fadeCallbackArg);
+}
+
+// Without hardware support to stop a fade (ESP32), nothing can be done here: the next LEDC duty update (ledcWrite() or a new fade)
+// blocks the calling task until the end of the ongoing fade, and is then applied (documented on fadeTo()).
+void Mycila::PWMDimmer::_stopFade() {
+  if (!_fading.exchange(false))
+    return;
+#if SOC_LEDC_SUPPORT_FADE_STOP
+  ledc_fade_stop(static_cast<ledc_mode_t>(_channel / SOC_LEDC_CHANNEL_NUM), static_cast<ledc_channel_t>(_channel % SOC_LEDC_CHANNEL_NUM));
+#endif
 }
@@ -6,6 +6,8 @@
 
 #include "MycilaDimmerPhaseControl.h"
 
+#include <atomic>
+
 #define MYCILA_DIMMER_PWM_RESOLUTION 12   // 12 bits resolution => 0-4095 watts
 #define MYCILA_DIMMER_PWM_FREQUENCY  1000 // 1 kHz
 
@@ -13,8 +15,11 @@ namespace Mycila {
   /**
    * @brief PWM based dimmer implementation for voltage regulators controlled by a PWM signal to 0-10V analog convertor
    */
-  class PWMDimmer : public PhaseControlDimmer {
+  class PWMDimmer final : public PhaseControlDimmer {
     public:
+      // called from the LEDC fade ISR when a fade started with fadeTo() has reached its target: runs in ISR context (IRAM, no blocking call, FreeRTOS *FromISR() functions only)
+      typedef void (*FadeCallback)(PWMDimmer& dimmer, void* arg);
+
       virtual ~PWMDimmer() { end(); }
 
       /**
@@ -47,6 +52,12 @@ namespace Mycila {
        */
       uint8_t getResolution() const { return _resolution; }
 
+      /**
+       * @brief Get the LEDC channel used by the dimmer, or -1 if not enabled
+       * @n Dimmers with the same frequency and resolution are paired on the 2 channels of a same LEDC timer.
+       */
+      int8_t getChannel() const { return _channel; }
+
       /**
        * @brief Enable a dimmer on a specific GPIO pin
        *
@@ -62,8 +73,38 @@ namespace Mycila {
        */
       void end() override;
 
+      /**
+       * @brief Fade the duty cycle to a target in a given duration with the LEDC fade hardware: no CPU is used during the fade
+       * @brief Any other duty cycle change stops the fade, and its callback is not called.
+       *
+       * @warning On the chips which cannot stop a LEDC fade (no SOC_LEDC_SUPPORT_FADE_STOP: ESP32), a duty cycle change (setDutyCycle(), rampTo(), fadeTo()...)
+       * during a fade blocks the calling task until the end of the fade, and is then applied: keep the fades short on these chips, or wait for isRamping() to be false.
+       *
+       * @param dutyCycle: the target power duty cycle in the range [0.0, 1.0]
+       * @param durationMs: the duration of the fade in ms (0: set the duty cycle immediately)
+       * @param callback: optional callback called from the LEDC fade ISR (ISR context, see FadeCallback) when the target is reached
+       */
+      bool fadeTo(float dutyCycle, uint32_t durationMs, FadeCallback callback = nullptr, void* arg = nullptr);
+
+      bool rampTo(float dutyCycle, uint32_t durationMs) override { return fadeTo(dutyCycle, durationMs); }
+      bool isRamping() const override { return _fading; }
+
       const char* type() const override { return "pwm"; }
 
+      /**
+       * @brief Same as Dimmer::setDutyCycle(), statically dispatched when called on a PWMDimmer (the class is final)
+       * @warning Blocks until the end of an ongoing fade on the chips which cannot stop a fade (see fadeTo())
+       */
+      bool setDutyCycle(float dutyCycle) { return PWMDimmer::setDutyCycleRaw(_toRaw(dutyCycle)); }
+
+      /**
+       * @brief Same as Dimmer::setDutyCycleRaw(), without any virtual call when called on a PWMDimmer
+       */
+      bool setDutyCycleRaw(uint16_t dutyCycle) override {
+        _updateDutyCycleRaw(dutyCycle);
+        return PhaseControlDimmer::isOnline() && PWMDimmer::_apply();
+      }
+
 #ifdef MYCILA_JSON_SUPPORT
       /**
        * @brief Serialize Dimmer information to a JSON object
@@ -75,21 +116,32 @@ namespace Mycila {
         root["pin"] = static_cast<int>(_pin);
         root["frequency"] = _frequency;
         root["resolution"] = _resolution;
+        root["channel"] = _channel;
       }
 #endif
 
-    protected:
-      bool _apply() override {
-        if (!isOnline()) {
-          return ledcWrite(_pin, 0);
-        }
-        uint32_t duty = getDutyCycleFire() * ((1 << _resolution) - 1);
-        return ledcWrite(_pin, duty);
+      void toSnapshot(DimmerSnapshot& snapshot) const override {
+        PhaseControlDimmer::toSnapshot(snapshot);
+        snapshot.type = DimmerSnapshot::Type::PWM;
       }
 
+    protected:
+      bool _apply() override;
+
     private:
       gpio_num_t _pin = GPIO_NUM_NC;
       uint32_t _frequency = MYCILA_DIMMER_PWM_FREQUENCY;
       uint8_t _resolution = MYCILA_DIMMER_PWM_RESOLUTION;
+      int8_t _channel = -1;
+
+      // fade requested by fadeTo()
+      bool _fadeRequested = false;
+      uint32_t _fadeMs = 0;
+      FadeCallback _fadeCallback = nullptr; // called from _fadeISR(), in ISR context
+      void* _fadeCallbackArg = nullptr;
+      std::atomic<bool> _fading{false};
+
+      static void _fadeISR(void* arg);
+      void _stopFade();
   };
 } // namespace Mycila
@@ -6,9 +6,25 @@
 
 #include "MycilaDimmer.h"
 
+#include "priv/power_lut.h"
+#include "priv/timer_service.h"
+
+// Number of entries of the power LUT (2 bytes of flash per entry)
+#ifndef MYCILA_DIMMER_LUT_SIZE
+  #define MYCILA_DIMMER_LUT_SIZE 200
+#endif
+
+// Number of bits the duty cycle is quantized to before looking up the power LUT (up to 16)
+#ifndef MYCILA_DIMMER_LUT_RESOLUTION
+  #define MYCILA_DIMMER_LUT_RESOLUTION 12
+#endif
+
 namespace Mycila {
   class PhaseControlDimmer : public Dimmer {
     public:
+      // number of timer ticks per us of the firing delays (see MYCILA_DIMMER_TIMER_RESOLUTION_HZ)
+      static constexpr uint32_t TICKS_PER_US = TimerService::TICKS_PER_US;
+
       virtual ~PhaseControlDimmer() { end(); }
 
       ///////////////
@@ -43,29 +59,12 @@ namespace Mycila {
       ////////////////////
 
       /**
-       * @brief Set the power duty, eventually remapped by the power LUT if enabled
+       * @brief Set the power duty in Q16, eventually remapped by the power LUT if enabled
        *
-       * @param dutyCycle: the power duty cycle in the range [0.0, 1.0]
+       * @param dutyCycle: the power duty cycle in the range [0, DUTY_CYCLE_RAW_MAX]
        */
-      bool setDutyCycle(float dutyCycle) override {
-        // Apply limit and save the wanted duty cycle.
-        // It will only be applied when dimmer will be on.
-        _dutyCycle = _contrain(dutyCycle, 0, _dutyCycleLimit);
-
-        const float mapped = getDutyCycleMapped();
-
-        if (_powerLUTEnabled) {
-          if (mapped == 0) {
-            _dutyCycleFire = 0.0f;
-          } else if (mapped == 1) {
-            _dutyCycleFire = 1.0f;
-          } else {
-            _dutyCycleFire = _semiPeriod > 0 ? (1.0f - static_cast<float>(_lookupFiringDelay(mapped)) / static_cast<float>(_semiPeriod)) : mapped;
-          }
-        } else {
-          _dutyCycleFire = mapped;
-        }
-
+      bool setDutyCycleRaw(uint16_t dutyCycle) override {
+        _updateDutyCycleRaw(dutyCycle);
         return isOnline() && _apply();
       }
 
@@ -79,11 +78,10 @@ namespace Mycila {
           return getDutyCycleMapped();
         } else {
           // Without LUT, we have a linear firing time.
-          // We calculate real Power Ratio from Phase Angle using the physical formula:
+          // The real Power Ratio from Phase Angle follows the physical formula:
           // P_ratio = d - sin(2 * pi * d) / (2 * pi)
-          const float duty = getDutyCycleFire();
-          // Optimization: use multiplication by inverse instead of division
-          return duty - sinf(2.0f * M_PI * duty) * (1.0f / (2.0f * M_PI));
+          // It is precomputed in a table to avoid calling sinf() each time the metrics are computed
+          return POWER_RATIOS.lookup(getDutyCycleFire());
         }
       }
 
@@ -99,28 +97,24 @@ namespace Mycila {
       }
 #endif
 
+      void toSnapshot(DimmerSnapshot& snapshot) const override {
+        Dimmer::toSnapshot(snapshot);
+        snapshot.setFlag(DimmerSnapshot::POWER_LUT, isPowerLUTEnabled());
+      }
+
     protected:
       bool _powerLUTEnabled = false;
 
-      static uint16_t _lookupFiringDelay(float dutyCycle) {
-        uint32_t duty = dutyCycle * FIRING_DELAY_MAX;
-        uint32_t slot = duty * FIRING_DELAYS_SCALE + (FIRING_DELAYS_SCALE >> 1);
-        uint32_t index = slot >> 16;
-        uint32_t a = FIRING_DELAYS[index];
-        uint32_t b = FIRING_DELAYS[index + 1];
-        uint32_t delay = a - (((a - b) * (slot & 0xffff)) >> 16); // interpolate a b
-        return (delay * _semiPeriod) >> 16;
-      }
-
-      bool _calculateDimmerHarmonics(float* array, size_t n) const override {
-        // getDutyCycleFire() returns the conduction angle normalized (0-1)
+      bool _calculateDimmerHarmonics(float* array, size_t n, float duty) const override {
+        // the firing duty cycle is the conduction angle normalized (0-1)
         // Convert to firing angle: α = π × (1 - conduction)
         // At 50% power: α ≈ 90° (π/2), which gives maximum harmonics
-        const float firingAngle = M_PI * (1.0f - _dutyCycleFire);
+        const float firingAngle = M_PI * (1.0f - duty);
 
         // Calculate RMS of fundamental component (reference)
         // Formula from Thierry Lequeu: I1_rms = (1/π) × √[2(π - α + ½sin(2α))]
         const float sin_2a = sinf(2.0f * firingAngle);
+        const float cos_2a = cosf(2.0f * firingAngle);
         const float i1_rms = sqrtf((2.0f / M_PI) * (M_PI - firingAngle + 0.5f * sin_2a));
 
         if (i1_rms <= 0.001f)
@@ -135,14 +129,23 @@ namespace Mycila {
         // Formula for phase-controlled resistive loads (IEEE standard):
         // Hn = (2/π√2) × |cos((n-1)α)/(n-1) - cos((n+1)α)/(n+1)| / I1_rms × 100%
         // This gives the correct harmonic magnitudes relative to the fundamental
+        //
+        // n-1 and n+1 are even: cos(2kα) is computed incrementally with the Chebyshev recurrence
+        // cos(2(k+1)α) = 2cos(2α) × cos(2kα) - cos(2(k-1)α), starting from cos(0) = 1 and cos(2α)
+        float cos_prev = 1.0f;   // cos(0)
+        float cos_curr = cos_2a; // cos(2α)
         for (size_t i = 1; i < n; i++) {
           const float n_f = static_cast<float>(2 * i + 1); // 3, 5, 7, 9, ...
           const float n_minus_1 = n_f - 1.0f;
           const float n_plus_1 = n_f + 1.0f;
 
+          // shift the recurrence: cos((n-1)α) is the previous cos((n+1)α)
+          const float cos_next = 2.0f * cos_2a * cos_curr - cos_prev;
+          cos_prev = cos_curr;
+          cos_curr = cos_next;
+
           // Compute Fourier coefficient
-          const float coeff = cosf(n_minus_1 * firingAngle) / n_minus_1 -
-                              cosf(n_plus_1 * firingAngle) / n_plus_1;
+          const float coeff = cos_prev / n_minus_1 - cos_curr / n_plus_1;
 
           // Convert to percentage of fundamental
           array[i] = fabsf(coeff) * scale_factor;
@@ -151,35 +154,23 @@ namespace Mycila {
         return true;
       }
 
+      // like Dimmer::_updateDutyCycleRaw(), with the firing duty cycle remapped by the power LUT if enabled
+      void _updateDutyCycleRaw(uint16_t dutyCycle) {
+        _dutyCycleRaw = dutyCycle < _dutyCycleLimitRaw ? dutyCycle : _dutyCycleLimitRaw;
+
+        const uint16_t mapped = getDutyCycleMappedRaw();
+
+        if (_powerLUTEnabled && _semiPeriod > 0 && mapped != 0 && mapped != DUTY_CYCLE_RAW_MAX) {
+          // the LUT gives the firing delay as a ratio of the semi-period
+          _dutyCycleFireRaw = DUTY_CYCLE_RAW_MAX - FIRING_DELAYS.lookup(mapped);
+        } else {
+          _dutyCycleFireRaw = mapped;
+        }
+      }
+
     private:
-      static constexpr uint32_t DIMMER_RESOLUTION = 12;
-      static constexpr uint32_t FIRING_DELAYS_LEN = 200;
-      static constexpr uint32_t FIRING_DELAY_MAX = (1 << DIMMER_RESOLUTION) - 1;
-      static constexpr uint32_t FIRING_DELAYS_SCALE = (FIRING_DELAYS_LEN - 1U) * (1UL << (16 - DIMMER_RESOLUTION));
-
-      // clang-format off
-      static constexpr uint16_t FIRING_DELAYS[FIRING_DELAYS_LEN] = {
-        0xffff, 0xe877, 0xe240, 0xddd9, 0xda51, 0xd74f, 0xd4aa, 0xd248, 0xd01a, 0xce16,
-        0xcc34, 0xca6e, 0xc8c0, 0xc728, 0xc5a1, 0xc42b, 0xc2c3, 0xc168, 0xc019, 0xbed3,
-        0xbd98, 0xbc65, 0xbb3b, 0xba17, 0xb8fb, 0xb7e5, 0xb6d5, 0xb5ca, 0xb4c5, 0xb3c4,
-        0xb2c8, 0xb1d1, 0xb0dd, 0xafed, 0xaf01, 0xae18, 0xad33, 0xac51, 0xab71, 0xaa95,
-        0xa9bb, 0xa8e3, 0xa80e, 0xa73b, 0xa66b, 0xa59c, 0xa4d0, 0xa406, 0xa33d, 0xa276,
-        0xa1b1, 0xa0ed, 0xa02b, 0x9f6b, 0x9eac, 0x9dee, 0x9d32, 0x9c76, 0x9bbc, 0x9b04,
-        0x9a4c, 0x9996, 0x98e0, 0x982b, 0x9778, 0x96c5, 0x9613, 0x9563, 0x94b2, 0x9403,
-        0x9354, 0x92a6, 0x91f9, 0x914c, 0x90a0, 0x8ff5, 0x8f4a, 0x8ea0, 0x8df6, 0x8d4d,
-        0x8ca4, 0x8bfb, 0x8b53, 0x8aab, 0x8a04, 0x895d, 0x88b6, 0x8810, 0x876a, 0x86c4,
-        0x861e, 0x8579, 0x84d3, 0x842e, 0x8389, 0x82e4, 0x823f, 0x819b, 0x80f6, 0x8051,
-        0x7fad, 0x7f08, 0x7e63, 0x7dbf, 0x7d1a, 0x7c75, 0x7bd0, 0x7b2b, 0x7a85, 0x79e0,
-        0x793a, 0x7894, 0x77ee, 0x7748, 0x76a1, 0x75fa, 0x7553, 0x74ab, 0x7403, 0x735a,
-        0x72b1, 0x7208, 0x715e, 0x70b4, 0x7009, 0x6f5e, 0x6eb2, 0x6e05, 0x6d58, 0x6caa,
-        0x6bfb, 0x6b4c, 0x6a9b, 0x69eb, 0x6939, 0x6886, 0x67d3, 0x671e, 0x6668, 0x65b2,
-        0x64fa, 0x6442, 0x6388, 0x62cc, 0x6210, 0x6152, 0x6093, 0x5fd3, 0x5f11, 0x5e4d,
-        0x5d88, 0x5cc1, 0x5bf8, 0x5b2e, 0x5a62, 0x5993, 0x58c3, 0x57f0, 0x571b, 0x5643,
-        0x5569, 0x548d, 0x53ad, 0x52cb, 0x51e6, 0x50fd, 0x5011, 0x4f21, 0x4e2d, 0x4d36,
-        0x4c3a, 0x4b39, 0x4a34, 0x4929, 0x4819, 0x4703, 0x45e7, 0x44c3, 0x4399, 0x4266,
-        0x412b, 0x3fe5, 0x3e96, 0x3d3b, 0x3bd3, 0x3a5d, 0x38d6, 0x373e, 0x3590, 0x33ca,
-        0x31e8, 0x2fe4, 0x2db6, 0x2b54, 0x28af, 0x25ad, 0x2225, 0x1dbe, 0x1787, 0x0000
-      };
-      // clang-format on
+      // generated at compile time, and stored in flash
+      static constexpr LUT::FiringDelays<MYCILA_DIMMER_LUT_SIZE, MYCILA_DIMMER_LUT_RESOLUTION> FIRING_DELAYS{};
+      static constexpr LUT::PowerRatios<MYCILA_DIMMER_LUT_SIZE> POWER_RATIOS{};
   };
 } // namespace Mycila
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#include "MycilaDimmerStats.h"
+#include "priv/msgpack_writer.h"
+
+#include <cmath>
+#include <cstdint>
+
+// Version of the DimmerSnapshot layout, increased at each incompatible change
+#define MYCILA_DIMMER_SNAPSHOT_VERSION 1
+
+namespace Mycila {
+  /**
+   * @brief Compact, fixed-layout binary snapshot of a dimmer, to publish telemetry without building a JSON document.
+   *
+   * The layout is packed and little-endian (native byte order of the ESP32) and does not depend on the build flags:
+   * fields which are not relevant for a dimmer type or build are zeroed and flagged as missing.
+   *
+   * - duty cycles are stored as 16-bit ratios: 0 = 0.0, 0xFFFF = 1.0
+   * - harmonics are stored in hundredths of percent of the fundamental (H1 = 10000), 0xFFFF when not available
+   */
+  struct __attribute__((packed)) DimmerSnapshot {
+      enum class Type : uint8_t {
+        VIRTUAL = 0,
+        THYRISTOR = 1,
+        CYCLE_STEALING = 2,
+        PWM = 3,
+        DFROBOT = 4,
+      };
+
+      enum Flags : uint8_t {
+        ENABLED = 1 << 0,
+        ONLINE = 1 << 1,
+        ON = 1 << 2,
+        POWER_LUT = 1 << 3,
+        HARMONICS = 1 << 4,    // harmonics are available
+        FIRING_DELAY = 1 << 5, // firingDelay is available (thyristor dimmers)
+        STATS = 1 << 6,        // stats are available (compiled with MYCILA_DIMMER_STATS)
+      };
+
+      static constexpr uint16_t NOT_AVAILABLE = UINT16_MAX;
+
+      uint8_t version = MYCILA_DIMMER_SNAPSHOT_VERSION;
+      Type type = Type::VIRTUAL;
+      uint8_t flags = 0;
+      uint8_t reserved = 0;
+      uint16_t semiPeriod = 0; // us
+      uint16_t dutyCycle = 0;
+      uint16_t dutyCycleMapped = 0;
+      uint16_t dutyCycleFire = 0;
+      uint16_t dutyCycleLimit = 0;
+      uint16_t dutyCycleMin = 0;
+      uint16_t dutyCycleMax = 0;
+      uint16_t firingDelay = 0; // us
+      uint16_t harmonics[11] = {NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE, NOT_AVAILABLE}; // H1 to H21
+      struct __attribute__((packed)) {
+          uint32_t zcEvents = 0;
+          uint32_t lateEvents = 0;
+          uint32_t isrReentries = 0;
+          uint32_t timerErrors = 0;
+          uint16_t isrTime[3] = {0, 0, 0};     // min, max, avg in us
+          uint16_t firingError[3] = {0, 0, 0}; // min, max, avg in us
+      } stats;
+
+      bool hasFlag(Flags flag) const { return flags & flag; }
+      void setFlag(Flags flag, bool value) { flags = value ? (flags | flag) : (flags & ~flag); }
+
+      // duty cycle in [0, 1] to a 16-bit ratio
+      static uint16_t toRatio(float value) {
+        if (!(value > 0))
+          return 0;
+        if (value >= 1)
+          return UINT16_MAX;
+        return static_cast<uint16_t>(value * UINT16_MAX + 0.5f);
+      }
+
+      // 16-bit ratio to a duty cycle in [0, 1]
+      static float fromRatio(uint16_t value) { return static_cast<float>(value) / UINT16_MAX; }
+
+      // harmonic level in % to hundredths of percent
+      static uint16_t toHarmonic(float value) {
+        if (std::isnan(value))
+          return NOT_AVAILABLE;
+        if (value <= 0)
+          return 0;
+        const float scaled = value * 100.0f + 0.5f;
+        return scaled >= NOT_AVAILABLE ? NOT_AVAILABLE - 1 : static_cast<uint16_t>(scaled);
+      }
+
+      void setStats(const DimmerStats& dimmerStats) {
+        stats.zcEvents = dimmerStats.zcEvents;
+        stats.lateEvents = dimmerStats.lateEvents;
+        stats.isrReentries = dimmerStats.isrReentries;
+        stats.timerErrors = dimmerStats.timerErrors;
+        stats.isrTime[0] = _clamp(dimmerStats.isrTime.min);
+        stats.isrTime[1] = _clamp(dimmerStats.isrTime.max);
+        stats.isrTime[2] = _clamp(dimmerStats.isrTime.avg());
+        stats.firingError[0] = _clamp(dimmerStats.firingError.min);
+        stats.firingError[1] = _clamp(dimmerStats.firingError.max);
+        stats.firingError[2] = _clamp(dimmerStats.firingError.avg());
+        setFlag(STATS, true);
+      }
+
+      /**
+       * @brief Encode the snapshot as a MessagePack array with the fields in the same order and units as the binary layout.
+       * Missing harmonics, firing delay and stats are encoded as nil. The encoding is usually smaller than the binary layout.
+       *
+       * @return the number of bytes written, or 0 if the buffer is too small
+       */
+      size_t toMsgPack(uint8_t* buffer, size_t size) const {
+        MsgPackWriter writer(buffer, size);
+        writer.array(13);
+        writer.uint(version);
+        writer.uint(static_cast<uint8_t>(type));
+        writer.uint(flags);
+        writer.uint(semiPeriod);
+        writer.uint(dutyCycle);
+        writer.uint(dutyCycleMapped);
+        writer.uint(dutyCycleFire);
+        writer.uint(dutyCycleLimit);
+        writer.uint(dutyCycleMin);
+        writer.uint(dutyCycleMax);
+        if (hasFlag(FIRING_DELAY))
+          writer.uint(firingDelay);
+        else
+          writer.nil();
+        if (hasFlag(HARMONICS)) {
+          writer.array(11);
+          for (size_t i = 0; i < 11; i++) {
+            if (harmonics[i] == NOT_AVAILABLE)
+              writer.nil();
+            else
+              writer.uint(harmonics[i]);
+          }
+        } else {
+          writer.nil();
+        }
+        if (hasFlag(STATS)) {
+          writer.array(10);
+          writer.uint(stats.zcEvents);
+          writer.uint(stats.lateEvents);
+          writer.uint(stats.isrReentries);
+          writer.uint(stats.timerErrors);
+          for (size_t i = 0; i < 3; i++)
+            writer.uint(stats.isrTime[i]);
+          for (size_t i = 0; i < 3; i++)
+            writer.uint(stats.firingError[i]);
+        } else {
+          writer.nil();
+        }
+        return writer.size();
+      }
+
+    private:
+      static uint16_t _clamp(uint32_t value) { return value > UINT16_MAX ? UINT16_MAX : value; }
+  };
+
+  static_assert(sizeof(DimmerSnapshot) == 70, "DimmerSnapshot layout changed: increase MYCILA_DIMMER_SNAPSHOT_VERSION");
+} // namespace Mycila
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#pragma once
+
+#ifdef MYCILA_JSON_SUPPORT
+  #include <ArduinoJson.h>
+#endif
+
+#include <cstdint>
+
+namespace Mycila {
+  /**
+   * @brief Min / max / average of a duration in us, recorded from an ISR
+   */
+  struct DimmerTimeStats {
+      uint32_t count = 0;
+      uint32_t min = 0;
+      uint32_t max = 0;
+      uint64_t sum = 0;
+
+      __attribute__((always_inline)) inline void record(uint32_t value) {
+        if (count == 0 || value < min)
+          min = value;
+        if (value > max)
+          max = value;
+        sum += value;
+        count++;
+      }
+
+      uint32_t avg() const { return count ? static_cast<uint32_t>(sum / count) : 0; }
+
+#ifdef MYCILA_JSON_SUPPORT
+      void toJson(const JsonObject& root) const {
+        root["min"] = min;
+        root["max"] = max;
+        root["avg"] = avg();
+      }
+#endif
+  };
+
+  /**
+   * @brief Statistics about the firing ISRs of the dimmers driven by a zero-cross detection, to detect a degraded firing precision.
+   *
+   * Only available when compiled with -D MYCILA_DIMMER_STATS: the counters are updated from the ISRs without any lock,
+   * so values read from task context might be slightly inconsistent with each other.
+   */
+  struct DimmerStats {
+      // number of ZC events received
+      uint32_t zcEvents = 0;
+      // number of semi-periods which were not fired because the ZC event was received too late
+      uint32_t lateEvents = 0;
+      // number of timer alarms skipped because the firing ISR was still running
+      uint32_t isrReentries = 0;
+      // number of ZC events or alarms ignored because the timer could not be read or set
+      uint32_t timerErrors = 0;
+      // execution time of the ISRs in us, measured with the firing timer counter
+      DimmerTimeStats isrTime;
+      // difference in us between the expected firing time (relative to the 0V crossing point) and the time at which dimmers were really fired
+      DimmerTimeStats firingError;
+
+#ifdef MYCILA_JSON_SUPPORT
+      void toJson(const JsonObject& root) const {
+        root["zc_events"] = zcEvents;
+        root["late_events"] = lateEvents;
+        root["isr_reentries"] = isrReentries;
+        root["timer_errors"] = timerErrors;
+        isrTime.toJson(root["isr_time"].to<JsonObject>());
+        firingError.toJson(root["firing_error"].to<JsonObject>());
+      }
+#endif
+  };
+} // namespace Mycila
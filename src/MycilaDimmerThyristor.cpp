@@ -6,19 +6,30 @@
 
 // lock
 #include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <mutex>
 
 // gpio
 #include <driver/gpio.h>
-#include <driver/gptimer_types.h>
 #include <esp32-hal-gpio.h>
-#include <hal/gpio_ll.h>
-#include <soc/gpio_struct.h>
 
 // logging
 #include <esp32-hal-log.h>
 
 // timers
-#include "priv/inlined_gptimer.h"
+#include <esp_timer.h>
+
+#if SOC_MCPWM_SUPPORTED
+  #include <driver/mcpwm_prelude.h>
+#endif
+
+#include "MycilaDimmerTrace.h"
+
+#include "priv/dimmer_registry.h"
+#include "priv/gpio_mask.h"
+#include "priv/timer_service.h"
+#include "priv/triple_buffer.h"
 
 #ifndef GPIO_IS_VALID_OUTPUT_GPIO
   #define GPIO_IS_VALID_OUTPUT_GPIO(gpio_num) ((gpio_num >= 0) && \
@@ -34,16 +45,23 @@
 // delay_us = asin((gate_resistor * gate_current) / grid_volt_max) / pi * period_us
 // delay_us = asin((330 * 0.03) / 325) / pi * 10000 = 97us
 #define PHASE_DELAY_MIN_US (90)
+#define PHASE_DELAY_MIN_TICKS (PHASE_DELAY_MIN_US * TICKS_PER_US)
 
-#define TAG "Thyristor"
+// Alarm count of the firing timer when there is no more dimmer to fire in the semi-period
+#define NO_ALARM (UINT32_MAX)
 
-static gptimer_handle_t fire_timer = nullptr;
+// Frequency tracking: weight of a new measure of the semi-period (1 / 2^shift), and maximum difference with the nominal semi-period (1 / divider)
+#define TRACKING_FILTER_SHIFT (3)
+#define TRACKING_RANGE_DIVIDER (8)
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-static portMUX_TYPE dimmers_spinlock = portMUX_INITIALIZER_UNLOCKED;
-#endif
+// Period of the MCPWM timer used for hardware firing: the timer is reset by the ZCD signal at each semi-period, so it only reaches its period
+// when ZC events are missing, and the gates are then turned off.
+#define HW_TIMER_PERIOD_TICKS (UINT16_MAX)
+
+#define TAG "Thyristor"
 
-Mycila::ThyristorDimmer::RegisteredDimmer* Mycila::ThyristorDimmer::dimmers = nullptr;
+// dimmers not assigned to a specific group
+Mycila::ThyristorDimmer::Group Mycila::ThyristorDimmer::_defaultGroup;
 
 bool Mycila::ThyristorDimmer::begin() {
   if (_enabled)
@@ -58,11 +76,12 @@ bool Mycila::ThyristorDimmer::begin() {
 
   pinMode(_pin, OUTPUT);
   digitalWrite(_pin, LOW);
-  _registerDimmer(this);
+  if (!_group->_registerDimmer(this))
+    return false;
   _enabled = true;
 
   // restart with last saved value
-  setDutyCycle(_dutyCycle);
+  setDutyCycleRaw(_dutyCycleRaw);
   return true;
 }
 
@@ -73,221 +92,645 @@ void Mycila::ThyristorDimmer::end() {
   _online = false;
   ESP_LOGI(TAG, "Disable dimmer on pin %" PRId8, _pin);
   _apply();
-  _unregisterDimmer(this);
+  _group->_unregisterDimmer(this);
   digitalWrite(_pin, LOW);
 }
 
-void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::onZeroCross(int16_t delayUntilZero, void* arg) {
-  // prepare our next alarm for the next dimmer to be fired
-  gptimer_alarm_config_t fire_timer_alarm_cfg = {.alarm_count = UINT16_MAX, .reload_count = 0, .flags = {.auto_reload_on_alarm = false}};
+bool Mycila::ThyristorDimmer::rampTo(float dutyCycle, uint32_t durationMs) {
+  const uint32_t semiPeriod = _group->getFiringSemiPeriodTicks() / TICKS_PER_US;
+  bool ramp = isOnline() && durationMs > 0 && semiPeriod > 0;
+#if SOC_MCPWM_SUPPORTED
+  // no ISR is running when firing in hardware
+  ramp = ramp && !_group->isHardwareFiring();
+#endif
+  if (!ramp)
+    return setDutyCycle(dutyCycle);
+
+  // start from the current firing delay of the ISR if a ramp is ongoing
+  _rampFrom = _rampState.running(_ramp) ? _rampState.value : _delayToRamp(_delay);
+  _rampSemiPeriods = static_cast<uint64_t>(durationMs) * 1000 / semiPeriod;
+  _rampRequested = true;
+  const bool applied = setDutyCycle(dutyCycle);
+  _rampRequested = false;
+  return applied;
+}
 
-  // immediately reset the firing timer to start counting from this ZC event and avoid it to trigger other alarms
-  if (inlined_gptimer_set_raw_count(fire_timer, 0) != ESP_OK) {
-    // failed to reset the timer: probably not initialized yet: just ignore this ZC event
+void Mycila::ThyristorDimmer::setGroup(Group& group) {
+  if (_enabled) {
+    ESP_LOGW(TAG, "Unable to change the group of the enabled dimmer on pin %" PRId8, _pin);
     return;
   }
+  _group = &group;
+}
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  // lock since we need to iterate over the list of dimmers
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
-#endif
-
-  // go through all registered dimmers to prepare the next firing
-  struct RegisteredDimmer* current = dimmers;
-  while (current != nullptr) {
-    if (current->dimmer->_delay) {
-      // if a delay is applied (dimmer is off (UINT16_MAX), or on with a delay > 0), turn off the triac and it will be turned on again later
-      gpio_ll_set_level(&GPIO, current->dimmer->_pin, LOW);
-      // calculate the next firing time:
-      // - If Dimmer is off (UINT16_MAX) => current->alarm_count == UINT16_MAX => dimmer will not be fired
-      // - If Dimmer is on with a delay > 0 => check to be sure it is PHASE_DELAY_MIN_US minimum
-      current->dimmer->alarm_count = current->dimmer->_delay < PHASE_DELAY_MIN_US ? PHASE_DELAY_MIN_US : current->dimmer->_delay;
-      // keep track the minimum delay at which we have to fire a dimmer
-      if (current->dimmer->alarm_count < fire_timer_alarm_cfg.alarm_count)
-        fire_timer_alarm_cfg.alarm_count = current->dimmer->alarm_count;
-    } else {
-      // no delay: dimmer has to be kept on: do nothing
-      gpio_ll_set_level(&GPIO, current->dimmer->_pin, HIGH);
-      // reset the alarm count to indicate that this dimmer was fired
-      current->dimmer->alarm_count = UINT16_MAX;
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::onZeroCross(int16_t delayUntilZero, void* group) {
+  (group ? static_cast<Group*>(group) : &_defaultGroup)->_onZeroCross(delayUntilZero);
+}
+
+// Shared timer event: called as soon as a dimmer of the group needs to be fired
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::_fireTimerISR(void* group) {
+  static_cast<Group*>(group)->_fire();
+}
+
+// ZC event of the default ZCD fanned out by the shared timer (default group only)
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::_zeroCrossISR(void* group, int16_t delayUntilZero, uint64_t zcTime) {
+  static_cast<Group*>(group)->_onZeroCross(delayUntilZero, zcTime);
+}
+
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::Group::_onZeroCross(int16_t delayUntilZero) {
+  uint64_t zcTime;
+  // failed to get the timer count: not started yet (no dimmer): just ignore this ZC event
+  if (TimerService::now(zcTime))
+    _onZeroCross(delayUntilZero, zcTime);
+}
+
+// the ZC ISR and the timer ISR can run on different cores: the per-group spinlock serializes them on the ISR state of the group
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::Group::_onZeroCross(int16_t delayUntilZero, uint64_t zcTime) {
+  portENTER_CRITICAL_SAFE(&_isrLock);
+  _zeroCross(delayUntilZero, zcTime);
+  portEXIT_CRITICAL_SAFE(&_isrLock);
+}
+
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::Group::_fire() {
+  portENTER_CRITICAL_SAFE(&_isrLock);
+  _fireDue();
+  portEXIT_CRITICAL_SAFE(&_isrLock);
+}
+
+// prepare the semi-period starting at the ZC event: caller must hold the ISR lock
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::Group::_zeroCross(int16_t delayUntilZero, uint64_t zcTime) {
+  // prepare our next alarm for the next dimmer to be fired
+  uint32_t alarm_count = NO_ALARM;
+
+  // immediately cancel the pending event of the last semi-period
+  TimerService::cancel(_timer);
+
+  // the firing delays are counted from the 0V crossing point, received delayUntilZero us after the ZC event
+  _origin = zcTime + static_cast<int64_t>(delayUntilZero) * TICKS_PER_US;
+
+#ifdef MYCILA_DIMMER_STATS
+  _stats.zcEvents++;
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+  DimmerTrace::record(DimmerTrace::Type::ZC, DimmerTrace::Source::THYRISTOR, zcTime, delayUntilZero);
+#endif
+
+  // start using the latest schedule published from task context: it won't change until the next ZC event
+  const FiringSchedule& schedule = _schedules.acquire();
+
+  // measure the semi-period between the 0V crossing points the firing delays are counted from (the delay until zero can change between the ZC events),
+  // ignoring the ones too far from the nominal semi-period (missing, or noisy ZC events)
+  const uint64_t interval = _origin - _lastOrigin;
+  _lastOrigin = _origin;
+  uint32_t tracked = 0;
+  if (_frequencyTracking) {
+    tracked = _trackedSemiPeriod.load(std::memory_order_relaxed);
+    if (schedule.semiPeriod && interval >= schedule.semiPeriod - schedule.semiPeriod / TRACKING_RANGE_DIVIDER && interval <= schedule.semiPeriod + schedule.semiPeriod / TRACKING_RANGE_DIVIDER) {
+      const int32_t measure = static_cast<int32_t>(interval << 4);
+      tracked = tracked ? static_cast<uint32_t>(static_cast<int32_t>(tracked) + ((measure - static_cast<int32_t>(tracked)) >> TRACKING_FILTER_SHIFT)) : static_cast<uint32_t>(measure);
+      _trackedSemiPeriod.store(tracked, std::memory_order_relaxed);
     }
-    current = current->next;
+  }
+  // the firing delays are fractions of the semi-period: scale them to the tracked one, or to the nominal one until it is tracked
+  const uint32_t semiPeriod = tracked ? (tracked + 8) >> 4 : schedule.semiPeriod;
+
+  // keep track of the semi-period from which a new schedule is used
+  const uint32_t semiPeriodCount = _semiPeriodCount.load(std::memory_order_relaxed) + 1;
+  _semiPeriodCount.store(semiPeriodCount, std::memory_order_relaxed);
+  if (schedule.sequence != _appliedSequence.load(std::memory_order_relaxed)) {
+    _appliedSemiPeriod.store(semiPeriodCount, std::memory_order_relaxed);
+    _appliedSequence.store(schedule.sequence, std::memory_order_relaxed);
   }
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-  // unlock the list of dimmers
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+  // no semi-period to scale the firing delays to (not known yet at startup, and not tracked yet):
+  // keep the dimmers with a delay off instead of firing them at the minimum delay (full power), only the dimmers with no delay stay on
+  if (semiPeriod == 0) {
+    schedule.off.setLow();
+    schedule.on.setHigh();
+    _rampSize = 0;
+    _rampCursor = 0;
+    _scheduleCursor = schedule.size;
+#ifdef MYCILA_DIMMER_TRACE
+    DimmerTrace::record(DimmerTrace::Type::SKIP, DimmerTrace::Source::THYRISTOR, zcTime, 0, schedule.off);
 #endif
+    return;
+  }
+
+  // prepare the next firing:
+  // - dimmers with a delay (dimmer is off, or on with a delay > 0) are turned off and the scheduled ones will be turned on again later
+  // - dimmers with no delay have to be kept on
+  schedule.off.setLow();
+  schedule.on.setHigh();
+#ifdef MYCILA_DIMMER_TRACE
+  GPIOMask fired = schedule.on;
+#endif
+
+  // advance the firing delay ramps and sort their firing events for this semi-period
+  _rampSize = 0;
+  _rampCursor = 0;
+  for (uint16_t r = 0; r < schedule.rampCount; r++) {
+    // the ramp value is a fraction of the semi-period (Q0.30): scale it to timer ticks (32 x 32 bits multiplication, no division)
+    const int32_t value = schedule.ramps[r].dimmer->_rampState.step(schedule.ramps[r].ramp);
+    const uint32_t delay = (static_cast<uint64_t>(value) * semiPeriod + (1UL << 29)) >> 30;
+    if (delay == 0) {
+      schedule.ramps[r].pin.setHigh();
+#ifdef MYCILA_DIMMER_TRACE
+      fired.add(schedule.ramps[r].pin);
+#endif
+      continue;
+    }
+    if (delay >= semiPeriod)
+      continue;
+    const uint32_t alarm_count = delay < PHASE_DELAY_MIN_TICKS ? PHASE_DELAY_MIN_TICKS : delay;
+    uint16_t i = _rampSize;
+    while (i > 0 && _rampAlarmCounts[i - 1] > alarm_count) {
+      _rampAlarmCounts[i] = _rampAlarmCounts[i - 1];
+      _rampPins[i] = _rampPins[i - 1];
+      i--;
+    }
+    _rampAlarmCounts[i] = alarm_count;
+    _rampPins[i] = schedule.ramps[r].pin;
+    _rampSize++;
+  }
+
+  // scale the firing delays of the schedule to timer ticks: they stay sorted
+  for (uint16_t i = 0; i < schedule.size; i++) {
+    const uint32_t delay = (static_cast<uint64_t>(schedule.delays[i]) * semiPeriod + (1ULL << 31)) >> 32;
+    _alarmCounts[i] = delay < PHASE_DELAY_MIN_TICKS ? PHASE_DELAY_MIN_TICKS : delay;
+  }
 
-  // get the time we spent looping and eventually waiting for the lock
-  uint64_t fire_timer_count_value;
-  if (inlined_gptimer_get_raw_count(fire_timer, &fire_timer_count_value) != ESP_OK) {
+  // the schedule is sorted: start with the first dimmers to fire
+  _scheduleCursor = 0;
+  if (schedule.size)
+    alarm_count = _alarmCounts[0];
+  if (_rampSize && _rampAlarmCounts[0] < alarm_count)
+    alarm_count = _rampAlarmCounts[0];
+
+  // get the time we spent looping: also used to schedule the first event, without reading the timer again
+  uint64_t now;
+  if (!TimerService::now(now)) {
     // failed to get the timer count: just ignore this ZC event
+#ifdef MYCILA_DIMMER_STATS
+    _stats.timerErrors++;
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+    DimmerTrace::record(DimmerTrace::Type::SKIP, DimmerTrace::Source::THYRISTOR, zcTime, 0);
+#endif
     return;
   }
 
-  // check if we had to wait too much time for the lock and we missed the 0V crossing point
-  if (fire_timer_count_value >= delayUntilZero) {
-    fire_timer_count_value -= delayUntilZero;
+#ifdef MYCILA_DIMMER_STATS
+  _stats.isrTime.record(static_cast<uint32_t>(now - zcTime) / TICKS_PER_US);
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+  if (!fired.empty())
+    DimmerTrace::record(DimmerTrace::Type::FIRE, DimmerTrace::Source::THYRISTOR, now, 0, fired);
+#endif
 
+  // check if the ZC event was received too late and we missed the 0V crossing point
+  if (now >= _origin) {
     // check if we missed the minimum time at which we have to turn the first dimmer on (next alarm)
-    if (fire_timer_count_value <= fire_timer_alarm_cfg.alarm_count) {
+    if (now - _origin <= alarm_count) {
       // directly call the firing ISR to turn on the first dimmer without waiting for an alarm
-      if (inlined_gptimer_set_raw_count(fire_timer, fire_timer_count_value) == ESP_OK) {
-        _fireTimerISR(fire_timer, nullptr, nullptr);
-      }
+      _fireDue();
     } else {
       // we are too late: do nothing: this is better to wait for the next ZC event than trying to turn on dimmers too late, which would create flickering
+#ifdef MYCILA_DIMMER_STATS
+      _stats.lateEvents++;
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+      DimmerTrace::record(DimmerTrace::Type::LATE, DimmerTrace::Source::THYRISTOR, now, static_cast<uint32_t>(now - _origin) / TICKS_PER_US);
+#endif
     }
 
-  } else {
-    // 0V crossing point not yet reached: set the counter to be at the right current position (very large number) before 0: the timer count will then overflow
-    if (inlined_gptimer_set_raw_count(fire_timer, -static_cast<uint64_t>(delayUntilZero) + fire_timer_count_value) == ESP_OK) {
-      // and set an alarm to be woken up at the right time: minimumCount
-      inlined_gptimer_set_alarm_action(fire_timer, &fire_timer_alarm_cfg);
-    }
+  } else if (alarm_count != NO_ALARM && !TimerService::schedule(_timer, _origin + alarm_count, now)) {
+    // 0V crossing point reached in the meantime, and the first dimmers are due
+    _fireDue();
   }
 }
 
-// Timer ISR to be called as soon as a dimmer needs to be fired
-bool ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::_fireTimerISR(gptimer_handle_t timer, const gptimer_alarm_event_data_t* event, void* arg) {
+// fire all the dimmers of the group which are due: caller must hold the ISR lock
+void ARDUINO_ISR_ATTR Mycila::ThyristorDimmer::Group::_fireDue() {
   // prepare our next alarm for the first dimmer to be fired
-  gptimer_alarm_config_t fire_timer_alarm_cfg = {.alarm_count = UINT16_MAX, .reload_count = 0, .flags = {.auto_reload_on_alarm = false}};
+  uint32_t alarm_count = NO_ALARM;
 
-  // get the time we spent looping and eventually waiting for the lock
-  uint64_t fire_timer_count_value;
-  if (inlined_gptimer_get_raw_count(fire_timer, &fire_timer_count_value) != ESP_OK) {
+  // get the current timer count value
+  uint64_t now;
+  if (!TimerService::now(now)) {
     // failed to get the timer count: just ignore this event
-    return false;
+#ifdef MYCILA_DIMMER_STATS
+    _stats.timerErrors++;
+#endif
+#ifdef MYCILA_DIMMER_TRACE
+    DimmerTrace::record(DimmerTrace::Type::SKIP, DimmerTrace::Source::THYRISTOR, 0, 0);
+#endif
+    return;
   }
 
+#ifdef MYCILA_DIMMER_STATS
+  const uint64_t isr_start = now;
+#endif
+
+  // events are counted from the 0V crossing point
+  uint64_t fire_timer_count_value = now - _origin;
+
+  // schedule acquired at the last ZC event
+  const FiringSchedule& schedule = _schedules.front();
+
   do {
-    fire_timer_alarm_cfg.alarm_count = UINT16_MAX;
+    alarm_count = NO_ALARM;
+#ifdef MYCILA_DIMMER_TRACE
+    GPIOMask fired;
+#endif
 
-#ifndef MYCILA_DIMMER_NO_LOCK
-    // lock since we need to iterate over the list of dimmers
-    portENTER_CRITICAL_SAFE(&dimmers_spinlock);
-#endif
-
-    // go through all registered dimmers and check the ones to fire
-    struct RegisteredDimmer* current = dimmers;
-    while (current != nullptr) {
-      if (current->dimmer->alarm_count != UINT16_MAX) {
-        // this dimmer has not yet been fired (< UINT16_MAX)
-        if (current->dimmer->alarm_count <= fire_timer_count_value) {
-          // timer alarm has reached this dimmer alarm => time to fire this dimmer
-          gpio_ll_set_level(&GPIO, current->dimmer->_pin, HIGH);
-          // reset the alarm count to indicate that this dimmer has been fired
-          current->dimmer->alarm_count = UINT16_MAX;
-        } else {
-          // dimmer has to be fired later => keep the minimum time at which we have to fire a dimmer
-          if (current->dimmer->alarm_count < fire_timer_alarm_cfg.alarm_count)
-            fire_timer_alarm_cfg.alarm_count = current->dimmer->alarm_count;
-        }
-      }
-      current = current->next;
+    // pop all the dimmers which are due: the schedule is sorted by alarm count, so we stop at the first ones to be fired later
+    while (_scheduleCursor < schedule.size && _alarmCounts[_scheduleCursor] <= fire_timer_count_value) {
+      schedule.pins[_scheduleCursor].setHigh();
+#ifdef MYCILA_DIMMER_TRACE
+      fired.add(schedule.pins[_scheduleCursor]);
+#endif
+#ifdef MYCILA_DIMMER_STATS
+      _stats.firingError.record(static_cast<uint32_t>(fire_timer_count_value - _alarmCounts[_scheduleCursor]) / TICKS_PER_US);
+#endif
+      _scheduleCursor++;
     }
-
-#ifndef MYCILA_DIMMER_NO_LOCK
-    // unlock the list of dimmers
-    portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+    while (_rampCursor < _rampSize && _rampAlarmCounts[_rampCursor] <= fire_timer_count_value) {
+      _rampPins[_rampCursor].setHigh();
+#ifdef MYCILA_DIMMER_TRACE
+      fired.add(_rampPins[_rampCursor]);
+#endif
+#ifdef MYCILA_DIMMER_STATS
+      _stats.firingError.record(static_cast<uint32_t>(fire_timer_count_value - _rampAlarmCounts[_rampCursor]) / TICKS_PER_US);
+#endif
+      _rampCursor++;
+    }
+#ifdef MYCILA_DIMMER_TRACE
+    if (!fired.empty())
+      DimmerTrace::record(DimmerTrace::Type::FIRE, DimmerTrace::Source::THYRISTOR, now, static_cast<uint32_t>(fire_timer_count_value) / TICKS_PER_US, fired);
 #endif
 
+    // keep the time at which we have to fire the next dimmers
+    if (_scheduleCursor < schedule.size)
+      alarm_count = _alarmCounts[_scheduleCursor];
+    if (_rampCursor < _rampSize && _rampAlarmCounts[_rampCursor] < alarm_count)
+      alarm_count = _rampAlarmCounts[_rampCursor];
+
     // refresh the current timer count value to check if we have to fire other dimmers
-    inlined_gptimer_get_raw_count(fire_timer, &fire_timer_count_value);
-  } while (fire_timer_alarm_cfg.alarm_count != UINT16_MAX && fire_timer_alarm_cfg.alarm_count <= fire_timer_count_value);
+    TimerService::now(now);
+    fire_timer_count_value = now - _origin;
 
-  // if there are some remaining dimmers to be fired, set an alarm for the next ones
-  if (fire_timer_alarm_cfg.alarm_count != UINT16_MAX)
-    inlined_gptimer_set_alarm_action(fire_timer, &fire_timer_alarm_cfg);
+    // if there are some remaining dimmers to be fired, schedule an event for the next ones, unless they are already due
+  } while (alarm_count != NO_ALARM && (alarm_count <= fire_timer_count_value || !TimerService::schedule(_timer, _origin + alarm_count, now)));
 
-  return false;
+#ifdef MYCILA_DIMMER_STATS
+  _stats.isrTime.record(static_cast<uint32_t>(now - isr_start) / TICKS_PER_US);
+#endif
 }
 
-// add a dimmer to the list of managed dimmers
-void Mycila::ThyristorDimmer::_registerDimmer(Mycila::ThyristorDimmer* dimmer) {
-  if (dimmers == nullptr) {
-    ESP_LOGI(TAG, "Starting dimmer firing ISR");
-
-    gptimer_config_t timer_config;
-    timer_config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
-    timer_config.direction = GPTIMER_COUNT_UP;
-    timer_config.resolution_hz = 1000000; // 1MHz resolution
-    timer_config.flags.intr_shared = true;
-    timer_config.intr_priority = 0;
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
-    timer_config.flags.backup_before_sleep = false;
+// add a dimmer to the list of dimmers managed by the group
+bool Mycila::ThyristorDimmer::Group::_registerDimmer(Mycila::ThyristorDimmer* dimmer) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
 #endif
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
-    timer_config.flags.allow_pd = false;
+
+  if (_dimmers.full()) {
+    ESP_LOGE(TAG, "Unable to register dimmer on pin %d: maximum of %d dimmers per group reached", dimmer->getPin(), MYCILA_DIMMER_MAX_THYRISTORS);
+    return false;
+  }
+
+#if SOC_MCPWM_SUPPORTED
+  if (isHardwareFiring()) {
+    if (_dimmers.empty() && !_startHardwareTimer())
+      return false;
+
+    if (!_registerHardwareDimmer(dimmer)) {
+      if (_dimmers.empty())
+        _stopHardwareTimer();
+      return false;
+    }
+
+    ESP_LOGD(TAG, "Register new hardware fired dimmer %p on pin %d", dimmer, dimmer->getPin());
+    _dimmers.add(dimmer);
+    return true;
+  }
 #endif
 
-    gptimer_event_callbacks_t callbacks_config;
-    callbacks_config.on_alarm = _fireTimerISR;
+  if (_dimmers.empty()) {
+    ESP_LOGI(TAG, "Starting dimmer firing ISR for group %p", this);
+    TimerService::checkISR("ThyristorDimmer::onZeroCross()", reinterpret_cast<const void*>(&ThyristorDimmer::onZeroCross));
 
-    ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, &fire_timer));
-    ESP_ERROR_CHECK(gptimer_register_event_callbacks(fire_timer, &callbacks_config, nullptr));
-    ESP_ERROR_CHECK(gptimer_enable(fire_timer));
-    ESP_ERROR_CHECK(gptimer_start(fire_timer));
+    // the default group also listens to the ZC events fanned out by Dimmers::onZeroCross()
+    _timer.onEvent = _fireTimerISR;
+    _timer.onZeroCross = this == &_defaultGroup ? _zeroCrossISR : nullptr;
+    _timer.arg = this;
+    if (!TimerService::attach(_timer))
+      return false;
   }
 
   ESP_LOGD(TAG, "Register new dimmer %p on pin %d", dimmer, dimmer->getPin());
 
+  _dimmers.add(dimmer);
+
+  _publishFiringSchedule();
+  return true;
+}
+
+// remove a dimmer from the list of dimmers managed by the group
+void Mycila::ThyristorDimmer::Group::_unregisterDimmer(Mycila::ThyristorDimmer* dimmer) {
+  ESP_LOGD(TAG, "Unregister dimmer %p on pin %d", dimmer, dimmer->getPin());
+
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
-#endif
-
-  if (dimmers == nullptr) {
-    dimmers = new RegisteredDimmer();
-    dimmers->dimmer = dimmer;
-  } else {
-    struct RegisteredDimmer* additional = new RegisteredDimmer();
-    additional->dimmer = dimmer;
-    additional->next = dimmers;
-    additional->prev = nullptr;
-    dimmers->prev = additional;
-    dimmers = additional;
+  std::unique_lock<std::mutex> lock(_mutex);
+#endif
+
+  _dimmers.remove(dimmer);
+
+#if SOC_MCPWM_SUPPORTED
+  if (isHardwareFiring()) {
+    // no ISR involved: the MCPWM resources can be released right away
+    _unregisterHardwareDimmer(dimmer);
+    if (_dimmers.empty())
+      _stopHardwareTimer();
+    return;
   }
+#endif
+
+  _publishFiringSchedule();
 
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+  lock.unlock();
 #endif
-}
 
-// remove a dimmer from the list of managed dimmers
-void Mycila::ThyristorDimmer::_unregisterDimmer(Mycila::ThyristorDimmer* dimmer) {
-  ESP_LOGD(TAG, "Unregister dimmer %p on pin %d", dimmer, dimmer->getPin());
+  // The dimmer pin must not be touched anymore by the ISR once unregistered, but the ISR keeps using its schedule until the next ZC event.
+  // So wait for the ISR to pick up the new schedule, or for enough time to be sure that no alarm from the old schedule can be pending.
+  const uint16_t semiPeriod = getSemiPeriod();
+  const int64_t timeout = 2 * static_cast<int64_t>(semiPeriod ? semiPeriod : 10000);
+  const int64_t start = esp_timer_get_time();
+  while (!_schedules.consumed() && esp_timer_get_time() - start < timeout) {
+    vTaskDelay(1);
+  }
 
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portENTER_CRITICAL_SAFE(&dimmers_spinlock);
+  lock.lock();
 #endif
 
-  struct RegisteredDimmer* current = dimmers;
-  while (current != nullptr) {
-    if (current->dimmer == dimmer) {
-      if (current->prev != nullptr) {
-        current->prev->next = current->next;
-      } else {
-        dimmers = current->next;
+  if (_dimmers.empty()) {
+    ESP_LOGI(TAG, "Stopping dimmer firing ISR for group %p", this);
+    TimerService::detach(_timer);
+  }
+}
+
+// rebuild the firing schedule from the dimmer delays, to be applied by the ISR at the next ZC event
+void Mycila::ThyristorDimmer::Group::_updateFiringSchedule([[maybe_unused]] Mycila::ThyristorDimmer* dimmer) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+#if SOC_MCPWM_SUPPORTED
+  if (isHardwareFiring()) {
+    // only the compare values of the updated dimmers have to be changed
+    _sequence++;
+    if (dimmer != nullptr) {
+      _updateHardwareDimmer(dimmer);
+      dimmer->_sequence = _sequence;
+    } else {
+      for (ThyristorDimmer* d : _dimmers) {
+        _updateHardwareDimmer(d);
+        d->_sequence = _sequence;
       }
-      if (current->next != nullptr) {
-        current->next->prev = current->prev;
+    }
+    _appliedSequence.store(_sequence, std::memory_order_relaxed);
+    return;
+  }
+#endif
+  _publishFiringSchedule();
+}
+
+// build and publish the next firing schedule, sorted by firing delay: caller must hold the lock
+void Mycila::ThyristorDimmer::Group::_publishFiringSchedule() {
+  FiringSchedule& schedule = _schedules.back();
+  schedule = FiringSchedule();
+  schedule.sequence = ++_sequence;
+  schedule.semiPeriod = getSemiPeriodTicks();
+
+  for (ThyristorDimmer* dimmer : _dimmers) {
+    const uint32_t delay = dimmer->_delay;
+    dimmer->_sequence = _sequence;
+
+    // dimmer ramping its firing delay: turned off at the ZC event, then fired by the ZC ISR from the current ramp value
+    if (dimmer->isRamping()) {
+      schedule.off.add(dimmer->_pin);
+      schedule.ramps[schedule.rampCount].dimmer = dimmer;
+      schedule.ramps[schedule.rampCount].pin = Mycila::GPIOMask();
+      schedule.ramps[schedule.rampCount].pin.add(dimmer->_pin);
+      schedule.ramps[schedule.rampCount].ramp = dimmer->_ramp;
+      schedule.rampCount++;
+      continue;
+    }
+
+    // no delay: dimmer has to be kept on
+    if (delay == 0) {
+      schedule.on.add(dimmer->_pin);
+      continue;
+    }
+
+    // if a delay is applied (dimmer is off (UINT32_MAX), or on with a delay > 0), turn off the triac at the ZC event and it will be turned on again later
+    schedule.off.add(dimmer->_pin);
+
+    // dimmer is off: it will not be fired
+    if (delay == UINT32_MAX)
+      continue;
+
+    // dimmer is on with a delay > 0: the ZC ISR scales it to the semi-period, with PHASE_DELAY_MIN_US minimum (Q16 to Q0.32: 0xFFFF x 65537 = 2^32 - 1)
+    const uint32_t fraction = delay * 65537;
+
+    // insertion sort: there are only a few dimmers, and the ones to fire at the same time are grouped
+    uint16_t i = 0;
+    while (i < schedule.size && schedule.delays[i] < fraction)
+      i++;
+    if (i == schedule.size || schedule.delays[i] != fraction) {
+      for (uint16_t j = schedule.size; j > i; j--) {
+        schedule.delays[j] = schedule.delays[j - 1];
+        schedule.pins[j] = schedule.pins[j - 1];
       }
-      delete current;
-      break;
+      schedule.delays[i] = fraction;
+      schedule.pins[i] = Mycila::GPIOMask();
+      schedule.size++;
     }
-    current = current->next;
+    schedule.pins[i].add(dimmer->_pin);
   }
 
+  _schedules.publish();
+}
+
+#if SOC_MCPWM_SUPPORTED
+bool Mycila::ThyristorDimmer::Group::enableHardwareFiring(gpio_num_t zcdPin, uint16_t delayUntilZero, int mcpwmGroup) {
 #ifndef MYCILA_DIMMER_NO_LOCK
-  portEXIT_CRITICAL_SAFE(&dimmers_spinlock);
+  std::lock_guard<std::mutex> lock(_mutex);
 #endif
 
-  if (dimmers == nullptr) {
-    ESP_LOGI(TAG, "Stopping dimmer firing ISR");
-    gptimer_stop(fire_timer); // might be already stopped
-    ESP_ERROR_CHECK(gptimer_disable(fire_timer));
-    ESP_ERROR_CHECK(gptimer_del_timer(fire_timer));
-    fire_timer = nullptr;
+  if (!_dimmers.empty()) {
+    ESP_LOGE(TAG, "Unable to enable hardware firing for group %p: some dimmers are already registered", this);
+    return false;
   }
+
+  if (!GPIO_IS_VALID_GPIO(zcdPin)) {
+    ESP_LOGE(TAG, "Invalid ZCD pin: %" PRId8, zcdPin);
+    return false;
+  }
+
+  if (mcpwmGroup < 0 || mcpwmGroup >= SOC_MCPWM_GROUPS) {
+    ESP_LOGE(TAG, "Invalid MCPWM group: %d", mcpwmGroup);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Enable hardware firing for group %p with ZCD on pin %" PRId8 " and MCPWM group %d", this, zcdPin, mcpwmGroup);
+
+  _hwZcdPin = zcdPin;
+  _hwDelayUntilZero = delayUntilZero;
+  _hwGroupId = mcpwmGroup;
+  return true;
 }
+
+// create the MCPWM timer reset by the ZCD signal: caller must hold the lock
+bool Mycila::ThyristorDimmer::Group::_startHardwareTimer() {
+  ESP_LOGI(TAG, "Starting MCPWM firing timer for group %p", this);
+
+  mcpwm_timer_config_t timer_config = {};
+  timer_config.group_id = _hwGroupId;
+  timer_config.clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT;
+  timer_config.resolution_hz = 1000000; // 1MHz resolution
+  timer_config.count_mode = MCPWM_TIMER_COUNT_MODE_UP;
+  timer_config.period_ticks = HW_TIMER_PERIOD_TICKS;
+
+  if (mcpwm_new_timer(&timer_config, &_hwTimer) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to start hardware firing: no more MCPWM timer available in group %d", _hwGroupId);
+    _hwTimer = nullptr;
+    return false;
+  }
+
+  mcpwm_gpio_sync_src_config_t sync_config = {};
+  sync_config.group_id = _hwGroupId;
+  sync_config.gpio_num = _hwZcdPin;
+
+  if (mcpwm_new_gpio_sync_src(&sync_config, &_hwSync) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to start hardware firing: no more MCPWM sync source available in group %d", _hwGroupId);
+    _hwSync = nullptr;
+    ESP_ERROR_CHECK(mcpwm_del_timer(_hwTimer));
+    _hwTimer = nullptr;
+    return false;
+  }
+
+  // each ZCD edge restarts the timer from 0
+  mcpwm_timer_sync_phase_config_t phase_config = {};
+  phase_config.sync_src = _hwSync;
+  phase_config.count_value = 0;
+  phase_config.direction = MCPWM_TIMER_DIRECTION_UP;
+
+  ESP_ERROR_CHECK(mcpwm_timer_set_phase_on_sync(_hwTimer, &phase_config));
+  ESP_ERROR_CHECK(mcpwm_timer_enable(_hwTimer));
+  ESP_ERROR_CHECK(mcpwm_timer_start_stop(_hwTimer, MCPWM_TIMER_START_NO_STOP));
+  return true;
+}
+
+// delete the MCPWM timer once the last dimmer is unregistered: caller must hold the lock
+void Mycila::ThyristorDimmer::Group::_stopHardwareTimer() {
+  if (_hwTimer == nullptr)
+    return;
+  ESP_LOGI(TAG, "Stopping MCPWM firing timer for group %p", this);
+  ESP_ERROR_CHECK(mcpwm_timer_start_stop(_hwTimer, MCPWM_TIMER_STOP_EMPTY));
+  ESP_ERROR_CHECK(mcpwm_timer_disable(_hwTimer));
+  ESP_ERROR_CHECK(mcpwm_del_timer(_hwTimer));
+  ESP_ERROR_CHECK(mcpwm_del_sync_src(_hwSync));
+  _hwTimer = nullptr;
+  _hwSync = nullptr;
+}
+
+// allocate an MCPWM operator for the dimmer: caller must hold the lock
+bool Mycila::ThyristorDimmer::Group::_registerHardwareDimmer(Mycila::ThyristorDimmer* dimmer) {
+  mcpwm_operator_config_t operator_config = {};
+  operator_config.group_id = _hwGroupId;
+
+  if (mcpwm_new_operator(&operator_config, &dimmer->_hwOperator) != ESP_OK) {
+    ESP_LOGE(TAG, "Unable to register dimmer on pin %d: no more MCPWM operator available in group %d", dimmer->getPin(), _hwGroupId);
+    dimmer->_hwOperator = nullptr;
+    return false;
+  }
+
+  ESP_ERROR_CHECK(mcpwm_operator_connect_timer(dimmer->_hwOperator, _hwTimer));
+
+  // new compare values are latched at the next ZCD edge, so a semi-period is never fired with a half-updated delay
+  mcpwm_comparator_config_t comparator_config = {};
+  comparator_config.flags.update_cmp_on_sync = true;
+  ESP_ERROR_CHECK(mcpwm_new_comparator(dimmer->_hwOperator, &comparator_config, &dimmer->_hwFireComparator));
+  ESP_ERROR_CHECK(mcpwm_new_comparator(dimmer->_hwOperator, &comparator_config, &dimmer->_hwZeroComparator));
+
+  mcpwm_generator_config_t generator_config = {};
+  generator_config.gen_gpio_num = dimmer->_pin;
+  ESP_ERROR_CHECK(mcpwm_new_generator(dimmer->_hwOperator, &generator_config, &dimmer->_hwGenerator));
+
+  // keep the gate off until a firing delay is applied
+  ESP_ERROR_CHECK(mcpwm_generator_set_force_level(dimmer->_hwGenerator, 0, true));
+
+  // gate turned on at the firing delay, and turned off at the next 0V crossing point (or if the timer is not reset anymore by the ZCD)
+  ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(dimmer->_hwGenerator, MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, dimmer->_hwFireComparator, MCPWM_GEN_ACTION_HIGH)));
+  ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(dimmer->_hwGenerator, MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, dimmer->_hwZeroComparator, MCPWM_GEN_ACTION_LOW)));
+  ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(dimmer->_hwGenerator, MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_FULL, MCPWM_GEN_ACTION_LOW)));
+
+  return true;
+}
+
+// release the MCPWM operator of the dimmer: caller must hold the lock
+void Mycila::ThyristorDimmer::Group::_unregisterHardwareDimmer(Mycila::ThyristorDimmer* dimmer) {
+  if (dimmer->_hwOperator == nullptr)
+    return;
+
+  ESP_ERROR_CHECK(mcpwm_generator_set_force_level(dimmer->_hwGenerator, 0, true));
+  ESP_ERROR_CHECK(mcpwm_del_generator(dimmer->_hwGenerator));
+  ESP_ERROR_CHECK(mcpwm_del_comparator(dimmer->_hwFireComparator));
+  ESP_ERROR_CHECK(mcpwm_del_comparator(dimmer->_hwZeroComparator));
+  ESP_ERROR_CHECK(mcpwm_del_operator(dimmer->_hwOperator));
+
+  dimmer->_hwGenerator = nullptr;
+  dimmer->_hwFireComparator = nullptr;
+  dimmer->_hwZeroComparator = nullptr;
+  dimmer->_hwOperator = nullptr;
+
+  // the pin is not driven by the MCPWM generator anymore
+  pinMode(dimmer->_pin, OUTPUT);
+}
+
+// apply the firing delay of the dimmer to its MCPWM operator: caller must hold the lock
+void Mycila::ThyristorDimmer::Group::_updateHardwareDimmer(Mycila::ThyristorDimmer* dimmer) {
+  if (dimmer->_hwGenerator == nullptr)
+    return;
+
+  // the MCPWM timer keeps a 1 MHz resolution: its 16-bit counter has to cover a whole semi-period
+  // no ISR measures the semi-period: the firing delay is scaled to the nominal one
+  const uint32_t delay = dimmer->_delay == UINT32_MAX ? UINT32_MAX : (_scaleRaw(dimmer->_delay, getSemiPeriodTicks()) + TICKS_PER_US - 1) / TICKS_PER_US;
+
+  // no delay: dimmer has to be kept on
+  if (delay == 0) {
+    ESP_ERROR_CHECK(mcpwm_generator_set_force_level(dimmer->_hwGenerator, 1, true));
+    return;
+  }
+
+  // dimmer is off: it will not be fired
+  if (delay == UINT32_MAX) {
+    ESP_ERROR_CHECK(mcpwm_generator_set_force_level(dimmer->_hwGenerator, 0, true));
+    return;
+  }
+
+  // the timer starts counting at the ZCD edge, which is received delayUntilZero us before the 0V crossing point
+  // the gate is turned off at 0V, but never at count 0, so that the compare event is not missed right when the sync event reloads the timer
+  const uint32_t zero_count = _hwDelayUntilZero ? _hwDelayUntilZero : 1;
+  uint32_t fire_count = _hwDelayUntilZero + (delay < PHASE_DELAY_MIN_US ? PHASE_DELAY_MIN_US : delay);
+  if (fire_count >= HW_TIMER_PERIOD_TICKS)
+    fire_count = HW_TIMER_PERIOD_TICKS - 1;
+
+  ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(dimmer->_hwZeroComparator, zero_count));
+  ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(dimmer->_hwFireComparator, fire_count));
+
+  // let the generator follow the compare events again
+  ESP_ERROR_CHECK(mcpwm_generator_set_force_level(dimmer->_hwGenerator, -1, true));
+}
+#endif
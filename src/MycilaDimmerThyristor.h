@@ -5,13 +5,236 @@
 #pragma once
 
 #include "MycilaDimmerPhaseControl.h"
-#include <driver/gptimer_types.h>
+#include "MycilaDimmerStats.h"
+#include <freertos/FreeRTOS.h>
+#include <soc/soc_caps.h>
+
+#if SOC_MCPWM_SUPPORTED
+  #include <driver/mcpwm_types.h>
+#endif
+
+#include <atomic>
+#include <mutex>
+
+#include "priv/dimmer_registry.h"
+#include "priv/gpio_mask.h"
+#include "priv/ramp.h"
+#include "priv/timer_service.h"
+#include "priv/triple_buffer.h"
+
+// Maximum number of thyristor dimmers which can be registered at the same time
+#ifndef MYCILA_DIMMER_MAX_THYRISTORS
+  #define MYCILA_DIMMER_MAX_THYRISTORS 8
+#endif
 
 namespace Mycila {
   /**
    * @brief Thyristor (TRIAC) based dimmer implementation for TRIAC and Random SSR dimmers
    */
-  class ThyristorDimmer : public PhaseControlDimmer {
+  class ThyristorDimmer final : public PhaseControlDimmer {
+    public:
+      /**
+       * @brief A group of thyristor dimmers synchronized on the same zero-cross detection.
+       *
+       * The groups share one firing timer, but each group has its own firing schedule, ISR state and semi-period, and is synchronized on its own ZC events,
+       * so that dimmers on different phases of a three-phase installation, each with its own ZCD, can be controlled independently and concurrently
+       * (groups do not share any lock, except the one of the shared timer taken to move its alarm).
+       *
+       * Dimmers which are not explicitly assigned to a group belong to the default group, which is used when onZeroCross() is called with a nullptr argument.
+       */
+      class Group {
+        public:
+          /**
+           * @brief Set the nominal semi-period in us of the grid phase this group is synchronized on
+           * @brief When not set (0), the global semi-period from Dimmer::setSemiPeriod() is used.
+           * @brief The firing delays are fractions of the semi-period: when frequency tracking is enabled, they follow the semi-period measured
+           * between the ZC events, and the nominal one is only used until the measure is locked, or when firing in hardware.
+           */
+          void setSemiPeriod(uint16_t semiPeriod) { _semiPeriod = semiPeriod; }
+
+          /**
+           * @brief Get the nominal semi-period in us of the grid phase this group is synchronized on
+           */
+          uint16_t getSemiPeriod() const { return _semiPeriod ? _semiPeriod : Dimmer::getSemiPeriod(); }
+
+          /**
+           * @brief Get the nominal semi-period in firing timer ticks (see MYCILA_DIMMER_TIMER_RESOLUTION_HZ)
+           */
+          uint32_t getSemiPeriodTicks() const { return static_cast<uint32_t>(getSemiPeriod()) * TICKS_PER_US; }
+
+          /**
+           * @brief Enable or disable the tracking of the grid frequency (enabled by default).
+           * @brief The ZC ISR measures the time between the 0V crossing points (ZC events + delay until zero) and scales the firing delays to it, so that the power stays correct
+           * when the grid frequency drifts (generator...). Measures more than 1/8 away from the nominal semi-period (missing or noisy ZC events) are ignored.
+           */
+          void setFrequencyTracking(bool enable) {
+            _frequencyTracking = enable;
+            _trackedSemiPeriod.store(0, std::memory_order_relaxed);
+          }
+
+          /**
+           * @brief Returns true if the firing delays follow the semi-period measured between the ZC events
+           */
+          bool isFrequencyTracking() const { return _frequencyTracking; }
+
+          /**
+           * @brief Get the semi-period in us measured between the ZC events (0 if not tracked yet, or when frequency tracking is disabled)
+           */
+          float getTrackedSemiPeriod() const { return static_cast<float>(_trackedSemiPeriod.load(std::memory_order_relaxed)) / (16 * TICKS_PER_US); }
+
+          /**
+           * @brief Get the semi-period in firing timer ticks the firing delays are currently scaled to: the tracked one if any, otherwise the nominal one
+           */
+          uint32_t getFiringSemiPeriodTicks() const {
+            const uint32_t tracked = _trackedSemiPeriod.load(std::memory_order_relaxed);
+            return tracked ? (tracked + 8) >> 4 : getSemiPeriodTicks();
+          }
+
+          /**
+           * @brief Get the number of dimmers currently registered in this group
+           */
+          size_t getDimmerCount() const { return _dimmers.size(); }
+
+          /**
+           * @brief Get the number of semi-periods (ZC events) processed by the firing ISR of this group (not updated when firing in hardware)
+           */
+          uint32_t getSemiPeriodCount() const { return _semiPeriodCount.load(std::memory_order_relaxed); }
+
+          /**
+           * @brief Get the sequence number of the last firing schedule used by the firing ISR of this group.
+           * @brief Schedules are only swapped at ZC events, so all the dimmers of the group use one consistent setpoint during a whole semi-period.
+           * @brief When firing in hardware, a schedule is considered applied once written to the MCPWM, which latches it at the next ZCD edge.
+           */
+          uint32_t getAppliedSequence() const { return _appliedSequence.load(std::memory_order_relaxed); }
+
+          /**
+           * @brief Get the semi-period (see getSemiPeriodCount()) from which the firing ISR started to use the last applied schedule
+           */
+          uint32_t getAppliedSemiPeriod() const { return _appliedSemiPeriod.load(std::memory_order_relaxed); }
+
+#ifdef MYCILA_DIMMER_STATS
+          /**
+           * @brief Get the statistics of the ZC and firing ISRs of this group (not updated when firing in hardware)
+           */
+          const DimmerStats& getStats() const { return _stats; }
+
+          /**
+           * @brief Reset the statistics of the ZC and firing ISRs of this group
+           */
+          void resetStats() { _stats = DimmerStats(); }
+#endif
+
+#if SOC_MCPWM_SUPPORTED
+          /**
+           * @brief Fire the dimmers of this group in hardware with the MCPWM peripheral instead of the firing ISR.
+           *
+           * The ZCD signal is routed to the MCPWM sync input: each ZCD edge resets the MCPWM timer, and each dimmer has its own MCPWM operator
+           * whose compare values are only updated when the duty cycle changes (they are latched at the next ZCD edge).
+           * So in steady state, firing the dimmers does not need any CPU interrupt, and onZeroCross() must not be called for this group.
+           *
+           * The ZCD pin can still be used by MycilaPulseAnalyzer, for example to detect the grid frequency.
+           *
+           * Each MCPWM group has 3 operators: a maximum of 3 dimmers can be fired in hardware per group (begin() returns false when there is no more operator available).
+           *
+           * @param zcdPin: the GPIO of the ZCD signal
+           * @param delayUntilZero: the delay in us between the rising edge of the ZCD signal and the real 0V crossing point
+           * - RobotDyn ZCD: about 200 us (pulse length of about 400 us)
+           * - ZCD from Daniel S: about 550 us (pulse length of about 1100 us)
+           * @param mcpwmGroup: the MCPWM group (peripheral) to use: 0 to SOC_MCPWM_GROUPS - 1
+           * @return false if some dimmers are already registered in this group (must be called before begin())
+           */
+          bool enableHardwareFiring(gpio_num_t zcdPin, uint16_t delayUntilZero, int mcpwmGroup = 0);
+
+          /**
+           * @brief Returns true if the dimmers of this group are fired in hardware by the MCPWM peripheral
+           */
+          bool isHardwareFiring() const { return _hwZcdPin != GPIO_NUM_NC; }
+#endif
+
+        private:
+          friend class ThyristorDimmer;
+
+          // firing events of all registered dimmers (structure of arrays for the ISR):
+          // - on:  pins kept on during the whole semi-period (no delay)
+          // - off: pins turned off at the ZC event (dimmer is off, or on with a delay)
+          // - delays / pins: pins to fire together after a delay from the 0V crossing point (fraction of the semi-period in Q0.32), sorted by delay
+          struct FiringSchedule {
+              GPIOMask on;
+              GPIOMask off;
+              uint32_t delays[MYCILA_DIMMER_MAX_THYRISTORS];
+              GPIOMask pins[MYCILA_DIMMER_MAX_THYRISTORS];
+              uint16_t size = 0;
+              uint32_t sequence = 0;
+              // dimmers ramping their firing delay (turned off at the ZC event like the others): the ZC ISR advances the ramps and fires them
+              struct {
+                  ThyristorDimmer* dimmer;
+                  GPIOMask pin;
+                  Ramp ramp;
+              } ramps[MYCILA_DIMMER_MAX_THYRISTORS];
+              uint16_t rampCount = 0;
+              uint32_t semiPeriod = 0; // nominal semi-period in timer ticks, used when the semi-period is not tracked
+          };
+
+          uint16_t _semiPeriod = 0;
+          // events of the group on the shared firing timer
+          TimerService::Client _timer;
+          // serializes the ZC ISR and the timer ISR of the group, which can run on different cores: guards all the ISR state below
+          portMUX_TYPE _isrLock = portMUX_INITIALIZER_UNLOCKED;
+          uint64_t _origin = 0; // timer count of the 0V crossing point of the current semi-period: only accessed from the ISRs, under the ISR lock
+#ifndef MYCILA_DIMMER_NO_LOCK
+          // only taken from task context to serialize the schedule updates: the ISRs never take it
+          std::mutex _mutex;
+#endif
+          // registered dimmers: only accessed from task context, under the lock
+          DimmerRegistry<ThyristorDimmer, MYCILA_DIMMER_MAX_THYRISTORS> _dimmers;
+          // schedules are built from task context and published to the ISRs: the ZC ISR picks the latest one at each ZC event, under the ISR lock
+          TripleBuffer<FiringSchedule> _schedules;
+          uint16_t _scheduleCursor = 0; // next event to fire in the current semi-period: only accessed from the ISRs, under the ISR lock
+          // firing events of the schedule in the current semi-period (number of timer ticks after the 0V crossing point): only accessed from the ISRs, under the ISR lock
+          uint32_t _alarmCounts[MYCILA_DIMMER_MAX_THYRISTORS];
+          // firing events of the ramping dimmers in the current semi-period, sorted by alarm count: only accessed from the ISRs, under the ISR lock
+          uint32_t _rampAlarmCounts[MYCILA_DIMMER_MAX_THYRISTORS];
+          GPIOMask _rampPins[MYCILA_DIMMER_MAX_THYRISTORS];
+          uint16_t _rampSize = 0;
+          uint16_t _rampCursor = 0;
+          uint32_t _sequence = 0;       // sequence number of the last published schedule: only accessed from task context, under the lock
+          // written by the ZC ISR, read from task context
+          std::atomic<uint32_t> _semiPeriodCount = {0};
+          std::atomic<uint32_t> _appliedSequence = {0};
+          std::atomic<uint32_t> _appliedSemiPeriod = {0};
+          // frequency tracking: semi-period measured between the 0V crossing points in timer ticks (Q28.4), 0 when not tracked
+          bool _frequencyTracking = true;
+          std::atomic<uint32_t> _trackedSemiPeriod = {0};
+          uint64_t _lastOrigin = 0; // 0V crossing point of the previous semi-period: only accessed from the ZC ISR, under the ISR lock
+#ifdef MYCILA_DIMMER_STATS
+          DimmerStats _stats; // only updated from the ISRs
+#endif
+
+#if SOC_MCPWM_SUPPORTED
+          gpio_num_t _hwZcdPin = GPIO_NUM_NC;
+          uint16_t _hwDelayUntilZero = 0;
+          int _hwGroupId = 0;
+          mcpwm_timer_handle_t _hwTimer = nullptr;
+          mcpwm_sync_handle_t _hwSync = nullptr;
+
+          bool _startHardwareTimer();
+          void _stopHardwareTimer();
+          bool _registerHardwareDimmer(ThyristorDimmer* dimmer);
+          void _unregisterHardwareDimmer(ThyristorDimmer* dimmer);
+          void _updateHardwareDimmer(ThyristorDimmer* dimmer);
+#endif
+
+          void _onZeroCross(int16_t delayUntilZero);
+          void _onZeroCross(int16_t delayUntilZero, uint64_t zcTime);
+          void _fire();
+          void _zeroCross(int16_t delayUntilZero, uint64_t zcTime); // caller must hold the ISR lock
+          void _fireDue();                                         // caller must hold the ISR lock
+          bool _registerDimmer(ThyristorDimmer* dimmer);
+          void _unregisterDimmer(ThyristorDimmer* dimmer);
+          void _updateFiringSchedule(ThyristorDimmer* dimmer); // nullptr: all the dimmers of the group
+          void _publishFiringSchedule();
+      };
+
     public:
       virtual ~ThyristorDimmer() { end(); }
 
@@ -25,20 +248,64 @@ namespace Mycila {
        */
       gpio_num_t getPin() const { return _pin; }
 
+      /**
+       * @brief Set the group (zero-cross detection) this dimmer is synchronized on
+       * @warning Must be called before begin(): the group of an enabled dimmer cannot be changed
+       */
+      void setGroup(Group& group);
+
+      /**
+       * @brief Get the group (zero-cross detection) this dimmer is synchronized on
+       */
+      Group& getGroup() const { return *_group; }
+
+      /**
+       * @brief Get the default group, used by dimmers which are not assigned to a specific group
+       */
+      static Group& getDefaultGroup() { return _defaultGroup; }
+
       /**
        * @brief Get the firing delay in us of the dimmer in the range [0, semi-period]
        * At 0% power, delay is equal to the semi-period: the dimmer is kept off
        * At 100% power, the delay is 0 us: the dimmer is kept on
        * This value is mostly used for TRIAC based dimmers but also in order to derive metrics based on the phase angle
        */
-      uint16_t getFiringDelay() const { return _delay > _semiPeriod ? _semiPeriod : _delay; }
+      uint16_t getFiringDelay() const { return getFiringDelayTicks() / TICKS_PER_US; }
+
+      /**
+       * @brief Get the firing delay in firing timer ticks (see MYCILA_DIMMER_TIMER_RESOLUTION_HZ) in the range [0, semi-period ticks]
+       * @brief The delay is scaled to the semi-period tracked from the ZC events, if any (see Group::getFiringSemiPeriodTicks())
+       */
+      uint32_t getFiringDelayTicks() const {
+        const uint32_t semiPeriod = _group->getFiringSemiPeriodTicks();
+        return _delay > DUTY_CYCLE_RAW_MAX ? semiPeriod : _scaleRaw(_delay, semiPeriod);
+      }
 
       /**
        * @brief Get the phase angle in degrees (°) of the dimmer in the range [0, 180]
        * At 0% power, the phase angle is equal to 180
        * At 100% power, the phase angle is equal to 0
        */
-      float getPhaseAngle() const { return _delay >= _semiPeriod ? 180 : 180 * _delay / _semiPeriod; }
+      float getPhaseAngle() const { return _delay >= DUTY_CYCLE_RAW_MAX ? 180 : 180.0f * _delay / DUTY_CYCLE_RAW_MAX; }
+
+      /**
+       * @brief Get the sequence number of the group firing schedule holding the last duty cycle applied to this dimmer
+       */
+      uint32_t getUpdateSequence() const { return _sequence; }
+
+      /**
+       * @brief Returns true once the firing ISR uses the last duty cycle applied to this dimmer (from semi-period Group::getAppliedSemiPeriod() at the latest)
+       */
+      bool isUpdateApplied() const { return static_cast<int32_t>(_group->getAppliedSequence() - _sequence) >= 0; }
+
+      /**
+       * @brief Ramp the firing delay linearly from the current one to the one of the target duty cycle, advanced by the ZC ISR at each semi-period.
+       * @brief When the power LUT is enabled, the ramp is still linear in firing delay between the current and target delays.
+       * @brief The target is directly applied when the dimmer is offline, there is no semi-period, or the group is fired in hardware.
+       */
+      bool rampTo(float dutyCycle, uint32_t durationMs) override;
+
+      bool isRamping() const override { return _ramp.active() && !_rampState.reached(_ramp); }
 
       /**
        * @brief Enable a dimmer on a specific GPIO pin
@@ -57,6 +324,19 @@ namespace Mycila {
 
       const char* type() const override { return "thyristor"; }
 
+      /**
+       * @brief Same as Dimmer::setDutyCycle(), statically dispatched when called on a ThyristorDimmer (the class is final)
+       */
+      bool setDutyCycle(float dutyCycle) { return ThyristorDimmer::setDutyCycleRaw(_toRaw(dutyCycle)); }
+
+      /**
+       * @brief Same as Dimmer::setDutyCycleRaw(), without any virtual call when called on a ThyristorDimmer
+       */
+      bool setDutyCycleRaw(uint16_t dutyCycle) override {
+        _updateDutyCycleRaw(dutyCycle);
+        return PhaseControlDimmer::isOnline() && ThyristorDimmer::_apply();
+      }
+
       /**
        * Callback to be called when a zero-crossing event is detected.
        *
@@ -66,8 +346,14 @@ namespace Mycila {
        *
        * - When using your own ISR with the RobotDyn ZCD,      you can call this method with delayUntilZero == 200 since the length of the ZCD pulse is about  400 us.
        * - When using your own ISR with the ZCd from Daniel S, you can call this method with delayUntilZero == 550 since the length of the ZCD pulse is about 1100 us.
+       *
+       * - When using several groups (i.e. one ZCD per phase), pass the group as argument:
+       *
+       * pulseAnalyzerL1.onZeroCross(Mycila::ThyristorDimmer::onZeroCross, &groupL1);
+       *
+       * @param group: the Group to fire, or nullptr for the default group
        */
-      static void onZeroCross(int16_t delayUntilZero, void* args);
+      static void onZeroCross(int16_t delayUntilZero, void* group);
 
 #ifdef MYCILA_JSON_SUPPORT
       /**
@@ -80,38 +366,81 @@ namespace Mycila {
         root["pin"] = _pin;
         root["firing_delay"] = getFiringDelay();
         root["firing_angle"] = getPhaseAngle();
+#ifdef MYCILA_DIMMER_STATS
+        _group->getStats().toJson(root["stats"].to<JsonObject>());
+#endif
       }
 #endif
 
+      void toSnapshot(DimmerSnapshot& snapshot) const override {
+        PhaseControlDimmer::toSnapshot(snapshot);
+        snapshot.type = DimmerSnapshot::Type::THYRISTOR;
+        snapshot.firingDelay = getFiringDelay();
+        snapshot.setFlag(DimmerSnapshot::FIRING_DELAY, true);
+#ifdef MYCILA_DIMMER_STATS
+        snapshot.setStats(_group->getStats());
+#endif
+      }
+
     protected:
       bool _apply() override {
-        float duty = getDutyCycleFire();
+        const uint16_t duty = getDutyCycleFireRaw();
         if (!isOnline() || duty == 0) {
-          _delay = UINT16_MAX;
-          return _enabled;
+          _delay = UINT32_MAX;
+        } else {
+          _delay = DUTY_CYCLE_RAW_MAX - duty;
         }
-        if (duty == 1) {
-          _delay = 0;
-          return _enabled;
+        // a new ramp to the new delay, or any other change which cancels the current ramp
+        if (_rampRequested) {
+          // ramp ids are never reused, so that the ISR restarts from the new start value
+          if (++_rampId == 0)
+            _rampId = 1;
+          _ramp.set(_rampId, _rampFrom, _delayToRamp(_delay), _rampSemiPeriods);
+        } else {
+          _ramp = Ramp();
         }
-        _delay = (1.0f - duty) * static_cast<float>(_semiPeriod);
+        // the firing ISR only reads the schedule, so it has to be rebuilt each time a delay changes
+        if (_enabled && !_batching)
+          _group->_updateFiringSchedule(this);
         return _enabled;
       }
 
+      const void* _batchResource() const override { return _group; }
+
+      bool _applyBatch() override {
+        if (!_enabled)
+          return false;
+        _group->_updateFiringSchedule(nullptr);
+        return true;
+      }
+
     private:
       gpio_num_t _pin = GPIO_NUM_NC;
-      uint16_t _delay = UINT16_MAX; // this is the next firing delay to apply
-      uint16_t alarm_count = UINT16_MAX; // when to fire the dimmer
+      uint32_t _delay = UINT32_MAX; // this is the next firing delay to apply, as a fraction of the semi-period (Q16: 0 to DUTY_CYCLE_RAW_MAX), or UINT32_MAX when off
+      uint32_t _sequence = 0;       // sequence number of the group firing schedule holding _delay
+      // firing delay ramp requested by rampTo(), as a fraction of the semi-period (Q0.30)
+      Ramp _ramp;
+      RampState _rampState; // only written by the ZC ISR
+      bool _rampRequested = false;
+      uint32_t _rampId = 0;
+      int32_t _rampFrom = 0;
+      uint32_t _rampSemiPeriods = 0;
 
-      struct RegisteredDimmer {
-          ThyristorDimmer* dimmer = nullptr;
-          RegisteredDimmer* prev = nullptr;
-          RegisteredDimmer* next = nullptr;
-      };
+      static Group _defaultGroup;
+      Group* _group = &_defaultGroup;
+
+#if SOC_MCPWM_SUPPORTED
+      // MCPWM resources used when the group fires its dimmers in hardware
+      mcpwm_oper_handle_t _hwOperator = nullptr;
+      mcpwm_cmpr_handle_t _hwFireComparator = nullptr; // firing delay: gate turned on
+      mcpwm_cmpr_handle_t _hwZeroComparator = nullptr; // 0V crossing point: gate turned off
+      mcpwm_gen_handle_t _hwGenerator = nullptr;
+#endif
+
+      // firing delay (Q16 fraction of the semi-period, or UINT32_MAX when off) to a ramp value (Q0.30 fraction of the semi-period)
+      static int32_t _delayToRamp(uint32_t delay) { return static_cast<int32_t>(_scaleRaw(delay > DUTY_CYCLE_RAW_MAX ? DUTY_CYCLE_RAW_MAX : delay, 1UL << 30)); }
 
-      static struct RegisteredDimmer* dimmers;
-      static bool _fireTimerISR(gptimer_handle_t timer, const gptimer_alarm_event_data_t* event, void* arg);
-      static void _registerDimmer(Mycila::ThyristorDimmer* dimmer);
-      static void _unregisterDimmer(Mycila::ThyristorDimmer* dimmer);
+      static void _fireTimerISR(void* group);
+      static void _zeroCrossISR(void* group, int16_t delayUntilZero, uint64_t zcTime);
   };
 } // namespace Mycila
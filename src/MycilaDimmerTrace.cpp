@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <MycilaDimmerTrace.h>
+
+#ifdef MYCILA_DIMMER_TRACE
+
+  #include <esp32-hal-gpio.h>
+
+  #define MASK (MYCILA_DIMMER_TRACE_SIZE - 1)
+
+Mycila::DimmerTrace::Ring Mycila::DimmerTrace::_rings[portNUM_PROCESSORS];
+
+void ARDUINO_ISR_ATTR Mycila::DimmerTrace::record(Type type, Source source, uint64_t time, int32_t delay, const GPIOMask& pins) {
+  // the interrupts of this core are the only producers of its ring: mask them so that a nested ISR cannot write the same slot
+  const UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+  Ring& ring = _rings[xPortGetCoreID()];
+  const uint32_t head = ring.head.load(std::memory_order_relaxed);
+  if (head - ring.tail.load(std::memory_order_acquire) >= MYCILA_DIMMER_TRACE_SIZE) {
+    ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  } else {
+    Event& event = ring.events[head & MASK];
+    event.time = static_cast<uint32_t>(time);
+    event.delay = static_cast<int16_t>(delay < INT16_MIN ? INT16_MIN : (delay > INT16_MAX ? INT16_MAX : delay));
+    event.type = type;
+    event.source = source;
+    event.pins = pins.low;
+  #if SOC_GPIO_PIN_COUNT > 32
+    event.pinsHigh = pins.high;
+  #else
+    event.pinsHigh = 0;
+  #endif
+    // publish the event to the consumer
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+  portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+void ARDUINO_ISR_ATTR Mycila::DimmerTrace::record(Type type, Source source, uint64_t time, int32_t delay) {
+  const GPIOMask none;
+  record(type, source, time, delay, none);
+}
+
+size_t Mycila::DimmerTrace::read(Event* events, size_t max) {
+  uint32_t heads[portNUM_PROCESSORS];
+  uint32_t tails[portNUM_PROCESSORS];
+  for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+    heads[c] = _rings[c].head.load(std::memory_order_acquire);
+    tails[c] = _rings[c].tail.load(std::memory_order_relaxed);
+  }
+
+  size_t count = 0;
+  while (count < max) {
+    // oldest event of all the rings (the timer count wraps: compare the differences)
+    int next = -1;
+    for (size_t c = 0; c < portNUM_PROCESSORS; c++) {
+      if (tails[c] == heads[c])
+        continue;
+      if (next < 0 || static_cast<int32_t>(_rings[c].events[tails[c] & MASK].time - _rings[next].events[tails[next] & MASK].time) < 0)
+        next = c;
+    }
+    if (next < 0)
+      break;
+    events[count++] = _rings[next].events[tails[next] & MASK];
+    tails[next]++;
+  }
+
+  // release the slots to the producers once copied
+  for (size_t c = 0; c < portNUM_PROCESSORS; c++)
+    _rings[c].tail.store(tails[c], std::memory_order_release);
+
+  return count;
+}
+
+size_t Mycila::DimmerTrace::drain(void (*callback)(const Event* events, size_t count, void* arg), void* arg) {
+  Event events[16];
+  size_t total = 0;
+  size_t count;
+  while ((count = read(events, 16)) > 0) {
+    callback(events, count, arg);
+    total += count;
+  }
+  return total;
+}
+
+uint32_t Mycila::DimmerTrace::getDropped() {
+  uint32_t dropped = 0;
+  for (size_t c = 0; c < portNUM_PROCESSORS; c++)
+    dropped += _rings[c].dropped.load(std::memory_order_relaxed);
+  return dropped;
+}
+
+const char* Mycila::DimmerTrace::toString(Type type) {
+  switch (type) {
+    case Type::ZC:
+      return "zc";
+    case Type::FIRE:
+      return "fire";
+    case Type::SKIP:
+      return "skip";
+    case Type::LATE:
+      return "late";
+    default:
+      return "unknown";
+  }
+}
+
+#endif // MYCILA_DIMMER_TRACE
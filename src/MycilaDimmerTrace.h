@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Trace of the events of the zero-cross and firing ISRs of the Thyristor and Cycle Stealing dimmers (compiled with -D MYCILA_DIMMER_TRACE).
+ *
+ * - Events are recorded by the ISRs in one ring buffer per core, without any lock: each ring has a single producer (the interrupts of its core,
+ *   which are masked for the few instructions writing an event so that nested ISRs do not interleave) and a single consumer (the task reading the trace).
+ * - When a ring is full, new events are dropped and counted, so that the ISRs never wait for the consumer.
+ * - Nothing is compiled when MYCILA_DIMMER_TRACE is not defined.
+ */
+#pragma once
+
+#ifdef MYCILA_DIMMER_TRACE
+
+  #include <freertos/FreeRTOS.h>
+
+  #include <atomic>
+  #include <cstddef>
+  #include <cstdint>
+
+  #include "priv/gpio_mask.h"
+
+  // Number of events of the ring buffer of each core (power of 2)
+  #ifndef MYCILA_DIMMER_TRACE_SIZE
+    #define MYCILA_DIMMER_TRACE_SIZE 128
+  #endif
+
+namespace Mycila {
+  class DimmerTrace {
+    public:
+      static_assert(MYCILA_DIMMER_TRACE_SIZE >= 2 && (MYCILA_DIMMER_TRACE_SIZE & (MYCILA_DIMMER_TRACE_SIZE - 1)) == 0, "MYCILA_DIMMER_TRACE_SIZE must be a power of 2");
+
+      enum class Type : uint8_t {
+        // ZC event received: delay is the delay until the 0V crossing point given by the ZCD (us)
+        ZC = 0,
+        // pins turned on: delay is the time since the 0V crossing point (us), or 0 for the cycle stealing dimmers
+        FIRE,
+        // pins not fired during this semi-period (cycle stealing), or event ignored (timer error, ISR re-entry) if there is no pin
+        SKIP,
+        // ZC event received too late: the semi-period is not fired
+        LATE,
+      };
+
+      enum class Source : uint8_t {
+        THYRISTOR = 0,
+        CYCLE_STEALING,
+      };
+
+      struct Event {
+          // low 32 bits of the count of the shared firing timer (MYCILA_DIMMER_TIMER_RESOLUTION_HZ)
+          uint32_t time;
+          int16_t delay;
+          Type type;
+          Source source;
+          // GPIO bitmask of the pins: GPIO 0-31, then GPIO 32+
+          uint32_t pins;
+          uint32_t pinsHigh;
+      };
+
+      /**
+       * @brief Record an event (ISR safe, lock-free)
+       */
+      static void record(Type type, Source source, uint64_t time, int32_t delay, const GPIOMask& pins);
+
+      /**
+       * @brief Record an event without pin (ISR safe, lock-free)
+       */
+      static void record(Type type, Source source, uint64_t time, int32_t delay);
+
+      /**
+       * @brief Read and remove the oldest events of the trace, merged by time from the rings of all the cores
+       * @warning Must be called from a single task at a time
+       * @return the number of events copied into events (at most max)
+       */
+      static size_t read(Event* events, size_t max);
+
+      /**
+       * @brief Read all the events of the trace and stream them by chunks to a callback (for example to send them to a web socket)
+       * @warning Must be called from a single task at a time
+       * @return the number of events streamed
+       */
+      static size_t drain(void (*callback)(const Event* events, size_t count, void* arg), void* arg = nullptr);
+
+      /**
+       * @brief Get the number of events dropped because a ring buffer was full
+       */
+      static uint32_t getDropped();
+
+      /**
+       * @brief Get the name of an event type
+       */
+      static const char* toString(Type type);
+
+    private:
+      struct Ring {
+          Event events[MYCILA_DIMMER_TRACE_SIZE];
+          // written by the producer only
+          std::atomic<uint32_t> head{0};
+          std::atomic<uint32_t> dropped{0};
+          // written by the consumer only
+          std::atomic<uint32_t> tail{0};
+      };
+
+      static Ring _rings[portNUM_PROCESSORS];
+  };
+} // namespace Mycila
+
+#endif // MYCILA_DIMMER_TRACE
@@ -0,0 +1,251 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include <MycilaDimmers.h>
+
+// logging
+#include <esp32-hal-log.h>
+
+#ifdef MYCILA_DIMMER_USE_ESP_DSP
+  #include <esp_dsp.h>
+#endif
+
+#define TAG "Dimmers"
+
+void ARDUINO_ISR_ATTR Mycila::Dimmers::onZeroCross(int16_t delayUntilZero, void* /* args */) {
+  TimerService::zeroCross(delayUntilZero);
+}
+
+bool Mycila::Dimmers::add(Mycila::Dimmer& dimmer) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  for (size_t i = 0; i < _size; i++)
+    if (_dimmers[i] == &dimmer)
+      return false;
+  if (_size >= MYCILA_DIMMERS_MAX_DIMMERS) {
+    ESP_LOGE(TAG, "Cannot add dimmer: too many dimmers (MYCILA_DIMMERS_MAX_DIMMERS=%d)", MYCILA_DIMMERS_MAX_DIMMERS);
+    return false;
+  }
+  _dimmers[_size] = &dimmer;
+  _isStaged[_size] = false;
+  _size++;
+  return true;
+}
+
+bool Mycila::Dimmers::remove(Mycila::Dimmer& dimmer) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  for (size_t i = 0; i < _size; i++) {
+    if (_dimmers[i] == &dimmer) {
+      // keep the order of the other dimmers, which is the index of the batch API
+      for (size_t j = i + 1; j < _size; j++) {
+        _dimmers[j - 1] = _dimmers[j];
+        _staged[j - 1] = _staged[j];
+        _isStaged[j - 1] = _isStaged[j];
+      }
+      _size--;
+      _dimmers[_size] = nullptr;
+      _isStaged[_size] = false;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Mycila::Dimmers::stageDutyCycle(size_t index, float dutyCycle) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  if (index >= _size)
+    return false;
+  _staged[index] = dutyCycle;
+  _isStaged[index] = true;
+  return true;
+}
+
+bool Mycila::Dimmers::commit() {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  return _commit();
+}
+
+bool Mycila::Dimmers::setDutyCycles(const float* dutyCycles, size_t count) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  if (count > _size)
+    count = _size;
+  for (size_t i = 0; i < count; i++) {
+    _staged[i] = dutyCycles[i];
+    _isStaged[i] = true;
+  }
+  return _commit();
+}
+
+bool Mycila::Dimmers::off() {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  for (size_t i = 0; i < _size; i++) {
+    _staged[i] = 0;
+    _isStaged[i] = true;
+  }
+  return _commit();
+}
+
+// apply the staged duty cycles: caller must hold the lock
+bool Mycila::Dimmers::_commit() {
+  bool success = true;
+
+  // update the state of the staged dimmers: the ones sharing a firing ISR are not published yet
+  for (size_t i = 0; i < _size; i++) {
+    if (!_isStaged[i])
+      continue;
+    Dimmer* dimmer = _dimmers[i];
+    dimmer->_batching = true;
+    success &= dimmer->setDutyCycle(_staged[i]);
+    dimmer->_batching = false;
+  }
+
+  // publish the states once per batch resource
+  const void* published[MYCILA_DIMMERS_MAX_DIMMERS];
+  size_t publishedCount = 0;
+  for (size_t i = 0; i < _size; i++) {
+    if (!_isStaged[i])
+      continue;
+    _isStaged[i] = false;
+    Dimmer* dimmer = _dimmers[i];
+    const void* resource = dimmer->_batchResource();
+    if (resource == nullptr || !dimmer->isOnline())
+      continue;
+    bool done = false;
+    for (size_t j = 0; j < publishedCount && !done; j++)
+      done = published[j] == resource;
+    if (done)
+      continue;
+    published[publishedCount++] = resource;
+    success &= dimmer->_applyBatch();
+  }
+
+  return success;
+}
+
+bool Mycila::Dimmers::calculateMetrics(Mycila::Dimmer::Metrics& metrics, float gridVoltage, const float* loadResistances) const {
+  MetricsArrays arrays;
+  return calculateMetrics(arrays, metrics, gridVoltage, loadResistances);
+}
+
+bool Mycila::Dimmers::calculateMetrics(MetricsArrays& metrics, Mycila::Dimmer::Metrics& total, float gridVoltage, const float* loadResistances) const {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(_mutex);
+#endif
+  return calculateMetrics(_dimmers, _size, metrics, total, gridVoltage, loadResistances);
+}
+
+// metrics of up to MYCILA_DIMMERS_MAX_DIMMERS dimmers, from their power ratios in [0, 1] and 1 / R (0 for an invalid load): see Dimmer::_computeMetrics()
+static void computeMetrics(size_t n, const float* ratio, const float* conductance, float gridVoltage, float* voltage, float* current, float* power, float* apparentPower, float* powerFactor, float* thdi) {
+  float tmp[MYCILA_DIMMERS_MAX_DIMMERS];
+  const float nominalPower = gridVoltage * gridVoltage;
+
+#ifdef MYCILA_DIMMER_USE_ESP_DSP
+  dsps_sqrt_f32(ratio, powerFactor, n);                      // PF = sqrt(ratio)
+  dsps_mulc_f32(powerFactor, voltage, n, gridVoltage, 1, 1); // V = PF x Vgrid
+  dsps_mul_f32(voltage, conductance, current, n, 1, 1, 1);   // I = V / R
+  dsps_mulc_f32(current, apparentPower, n, gridVoltage, 1, 1);
+  dsps_mul_f32(ratio, conductance, power, n, 1, 1, 1); // P = ratio x Vgrid^2 / R
+  dsps_mulc_f32(power, power, n, nominalPower, 1, 1);
+#else
+  for (size_t i = 0; i < n; i++) {
+    powerFactor[i] = sqrtf(ratio[i]);
+    voltage[i] = powerFactor[i] * gridVoltage;
+    current[i] = voltage[i] * conductance[i];
+    apparentPower[i] = current[i] * gridVoltage;
+    power[i] = ratio[i] * conductance[i] * nominalPower;
+  }
+#endif
+
+  // THDi = sqrt(1 / PF^2 - 1) = sqrt((1 - ratio) / ratio), for a resistive load: not defined without power
+  for (size_t i = 0; i < n; i++)
+    tmp[i] = ratio[i] > 0 ? (1.0f - ratio[i]) / ratio[i] : 0.0f;
+#ifdef MYCILA_DIMMER_USE_ESP_DSP
+  dsps_sqrt_f32(tmp, thdi, n);
+  dsps_mulc_f32(thdi, thdi, n, 100.0f, 1, 1);
+#else
+  for (size_t i = 0; i < n; i++)
+    thdi[i] = 100.0f * sqrtf(tmp[i]);
+#endif
+  for (size_t i = 0; i < n; i++) {
+    if (ratio[i] <= 0 || conductance[i] <= 0) {
+      powerFactor[i] = NAN;
+      thdi[i] = NAN;
+    }
+  }
+}
+
+bool Mycila::Dimmers::calculateMetrics(const Dimmer* const* dimmers, size_t count, MetricsArrays& metrics, Mycila::Dimmer::Metrics& total, float gridVoltage, const float* loadResistances) {
+  float ratio[MYCILA_DIMMERS_MAX_DIMMERS];
+  float conductance[MYCILA_DIMMERS_MAX_DIMMERS];
+  float voltage[MYCILA_DIMMERS_MAX_DIMMERS];
+  float current[MYCILA_DIMMERS_MAX_DIMMERS];
+  float power[MYCILA_DIMMERS_MAX_DIMMERS];
+  float apparentPower[MYCILA_DIMMERS_MAX_DIMMERS];
+  float powerFactor[MYCILA_DIMMERS_MAX_DIMMERS];
+  float thdi[MYCILA_DIMMERS_MAX_DIMMERS];
+
+  total = Dimmer::Metrics();
+  bool success = true;
+
+  // by chunks of MYCILA_DIMMERS_MAX_DIMMERS dimmers, so that the buffers stay on the stack
+  for (size_t offset = 0; offset < count; offset += MYCILA_DIMMERS_MAX_DIMMERS) {
+    const size_t n = count - offset < MYCILA_DIMMERS_MAX_DIMMERS ? count - offset : MYCILA_DIMMERS_MAX_DIMMERS;
+
+    // the only per-dimmer calls: everything else is computed on arrays
+    for (size_t i = 0; i < n; i++) {
+      const Dimmer* dimmer = dimmers[offset + i];
+      const float loadResistance = loadResistances[offset + i];
+      if (!dimmer->isEnabled() || loadResistance <= 0 || gridVoltage <= 0) {
+        success = false;
+        ratio[i] = 0.0f;
+        conductance[i] = 0.0f;
+        continue;
+      }
+      const float r = dimmer->getPowerRatio();
+      ratio[i] = r <= 0 ? 0.0f : (r >= 1 ? 1.0f : r);
+      conductance[i] = 1.0f / loadResistance;
+    }
+
+    computeMetrics(n, ratio, conductance, gridVoltage, voltage, current, power, apparentPower, powerFactor, thdi);
+
+    for (size_t i = 0; i < n; i++) {
+      total.current += current[i];
+      total.power += power[i];
+      total.apparentPower += apparentPower[i];
+    }
+
+    const size_t bytes = n * sizeof(float);
+    if (metrics.voltage != nullptr)
+      memcpy(metrics.voltage + offset, voltage, bytes);
+    if (metrics.current != nullptr)
+      memcpy(metrics.current + offset, current, bytes);
+    if (metrics.power != nullptr)
+      memcpy(metrics.power + offset, power, bytes);
+    if (metrics.apparentPower != nullptr)
+      memcpy(metrics.apparentPower + offset, apparentPower, bytes);
+    if (metrics.powerFactor != nullptr)
+      memcpy(metrics.powerFactor + offset, powerFactor, bytes);
+    if (metrics.thdi != nullptr)
+      memcpy(metrics.thdi + offset, thdi, bytes);
+  }
+
+  if (total.apparentPower > 0) {
+    total.voltage = total.current > 0 ? total.apparentPower / total.current : 0.0f;
+    total.powerFactor = total.power / total.apparentPower;
+    total.thdi = total.powerFactor >= 1.0f ? 0.0f : 100.0f * std::sqrt(1.0f / (total.powerFactor * total.powerFactor) - 1.0f);
+  }
+
+  return success;
+}
@@ -8,3 +8,151 @@
 #include "MycilaDimmerDFRobot.h"
 #include "MycilaDimmerPWM.h"
 #include "MycilaDimmerThyristor.h"
+#include "MycilaDimmerTrace.h"
+
+#ifndef MYCILA_DIMMER_NO_LOCK
+  #include <mutex>
+#endif
+
+// Maximum number of dimmers which can be added to a Dimmers collection
+#ifndef MYCILA_DIMMERS_MAX_DIMMERS
+  #define MYCILA_DIMMERS_MAX_DIMMERS 16
+#endif
+
+// Set to use the esp-dsp vector functions (ESP32-S3 PIE, ESP32 AE32...) in calculateMetrics()
+// #define MYCILA_DIMMER_USE_ESP_DSP
+
+namespace Mycila {
+  /**
+   * @brief A collection of dimmers, of any type, updated together.
+   *
+   * Duty cycles are staged then committed in one batch: the firing schedule of each thyristor group and the cycle stealing states are
+   * only rebuilt and published once per commit, under a single lock, so that all the dimmers of a same ZCD change on the same semi-period.
+   * Other dimmers (PWM, DFRobot) are applied one after the other during the commit.
+   *
+   * Dimmers keep the order in which they were added: this is the index used by the batch API.
+   */
+  class Dimmers {
+    public:
+      /**
+       * @brief Add a dimmer to the collection
+       * @return false if the dimmer is already part of the collection or if the collection is full (see MYCILA_DIMMERS_MAX_DIMMERS)
+       */
+      bool add(Dimmer& dimmer);
+
+      /**
+       * @brief Remove a dimmer from the collection: the dimmers added after it are moved one index down
+       * @return false if the dimmer is not part of the collection
+       */
+      bool remove(Dimmer& dimmer);
+
+      size_t size() const { return _size; }
+      Dimmer* operator[](size_t index) const { return index < _size ? _dimmers[index] : nullptr; }
+
+      Dimmer* const* begin() const { return _dimmers; }
+      Dimmer* const* end() const { return _dimmers + _size; }
+
+      /**
+       * @brief Zero-cross callback for the installations mixing thyristor and cycle stealing dimmers on the same ZCD.
+       *
+       * All the ZC-driven dimmers share one firing timer: the ZC event is timestamped once and dispatched to the dimmers of the default thyristor group
+       * and to the cycle stealing dimmers, so a single callback has to be registered:
+       *
+       * pulseAnalyzer.onZeroCross(Mycila::Dimmers::onZeroCross);
+       *
+       * Thyristor groups with their own ZCD are still fired with ThyristorDimmer::onZeroCross().
+       */
+      static void onZeroCross(int16_t delayUntilZero, void* args);
+
+      ///////////
+      // BATCH //
+      ///////////
+
+      /**
+       * @brief Stage the duty cycle of a dimmer, which will be applied at the next commit()
+       * @return false if the index is out of range
+       */
+      bool stageDutyCycle(size_t index, float dutyCycle);
+
+      /**
+       * @brief Apply all the staged duty cycles
+       * @return true if all the staged dimmers were online and successfully applied
+       */
+      bool commit();
+
+      /**
+       * @brief Set the duty cycles of the first count dimmers of the collection in one batch
+       * @return true if all the dimmers were online and successfully applied
+       */
+      bool setDutyCycles(const float* dutyCycles, size_t count);
+
+      /**
+       * @brief Turn off all the dimmers of the collection in one batch
+       */
+      bool off();
+
+      /////////////
+      // METRICS //
+      /////////////
+
+      /**
+       * @brief Calculate the total metrics of the dimmers of the collection for resistive loads
+       *
+       * Powers and currents are summed: on a same phase, the total current and apparent power are an upper bound when the dimmers fire at different angles.
+       * The output voltage is the equivalent voltage of the total apparent power and current.
+       *
+       * @param metrics: the total metrics
+       * @param gridVoltage: the grid voltage
+       * @param loadResistances: the load resistance of each dimmer of the collection (size() values)
+       * @return false if one of the dimmers metrics could not be computed
+       */
+      bool calculateMetrics(Dimmer::Metrics& metrics, float gridVoltage, const float* loadResistances) const;
+
+      /**
+       * @brief Metrics of many dimmers, in structure of arrays form: each array has one value per dimmer, and can be nullptr if not needed
+       */
+      struct MetricsArrays {
+          float* voltage = nullptr;
+          float* current = nullptr;
+          float* power = nullptr;
+          float* apparentPower = nullptr;
+          float* powerFactor = nullptr;
+          float* thdi = nullptr;
+      };
+
+      /**
+       * @brief Calculate the metrics of the dimmers of the collection for resistive loads, and their total (see calculateMetrics())
+       * @param metrics: the metrics of each dimmer of the collection (size() values per array)
+       */
+      bool calculateMetrics(MetricsArrays& metrics, Dimmer::Metrics& total, float gridVoltage, const float* loadResistances) const;
+
+      /**
+       * @brief Calculate the metrics of an array of dimmers for resistive loads, and their total
+       *
+       * Only the power ratios are read from the dimmers: the metrics are then computed for all the dimmers at once, with loops over arrays
+       * which the compiler can vectorize, or with the esp-dsp vector functions when MYCILA_DIMMER_USE_ESP_DSP is defined.
+       * The metrics of the dimmers which are disabled, or whose load resistance is not positive, are the ones of a dimmer without power.
+       *
+       * @param dimmers: the dimmers
+       * @param count: the number of dimmers
+       * @param metrics: the metrics of each dimmer (count values per array)
+       * @param total: the total metrics
+       * @param gridVoltage: the grid voltage
+       * @param loadResistances: the load resistance of each dimmer (count values)
+       * @return false if the metrics of one of the dimmers could not be computed
+       */
+      static bool calculateMetrics(const Dimmer* const* dimmers, size_t count, MetricsArrays& metrics, Dimmer::Metrics& total, float gridVoltage, const float* loadResistances);
+
+    private:
+      Dimmer* _dimmers[MYCILA_DIMMERS_MAX_DIMMERS] = {};
+      float _staged[MYCILA_DIMMERS_MAX_DIMMERS] = {};
+      bool _isStaged[MYCILA_DIMMERS_MAX_DIMMERS] = {};
+      size_t _size = 0;
+#ifndef MYCILA_DIMMER_NO_LOCK
+      // serializes the changes of the collection and the commits
+      mutable std::mutex _mutex;
+#endif
+
+      bool _commit();
+  };
+} // namespace Mycila
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Fixed-capacity registry of the dimmers driven by a firing ISR.
+ *
+ * The registry is statically allocated (internal DRAM) and only accessed from task context, under the caller lock:
+ * no heap allocation happens when dimmers are registered or unregistered, so long-running nodes do not fragment the heap.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Mycila {
+  template <typename T, size_t N>
+  class DimmerRegistry {
+    public:
+      static constexpr size_t capacity() { return N; }
+
+      size_t size() const { return _size; }
+      bool empty() const { return _size == 0; }
+      bool full() const { return _size >= N; }
+
+      T* operator[](size_t index) const { return _dimmers[index]; }
+
+      T* const* begin() const { return _dimmers; }
+      T* const* end() const { return _dimmers + _size; }
+
+      /**
+       * @brief Add a dimmer to the registry
+       * @return false if the registry is full
+       */
+      bool add(T* dimmer) {
+        if (_size >= N)
+          return false;
+        _dimmers[_size++] = dimmer;
+        return true;
+      }
+
+      /**
+       * @brief Remove a dimmer from the registry (the order of the other dimmers is not kept)
+       * @return false if the dimmer was not registered
+       */
+      bool remove(T* dimmer) {
+        for (size_t i = 0; i < _size; i++) {
+          if (_dimmers[i] == dimmer) {
+            _dimmers[i] = _dimmers[--_size];
+            _dimmers[_size] = nullptr;
+            return true;
+          }
+        }
+        return false;
+      }
+
+    private:
+      T* _dimmers[N] = {};
+      size_t _size = 0;
+  };
+} // namespace Mycila
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Set of GPIO outputs which can be switched together with a single write to the GPIO set/clear registers
+ * (plus one write to the second bank of registers on chips with more than 32 GPIOs).
+ *
+ * Functions are marked as forced inline, in order to be used from ISR in IRAM.
+ */
+#pragma once
+
+#include <driver/gpio.h>
+#include <soc/gpio_reg.h>
+#include <soc/soc.h>
+#include <soc/soc_caps.h>
+
+#include <cstdint>
+
+namespace Mycila {
+  struct GPIOMask {
+      uint32_t low = 0; // GPIO 0-31
+#if SOC_GPIO_PIN_COUNT > 32
+      uint32_t high = 0; // GPIO 32+
+#endif
+
+      void add(gpio_num_t pin) {
+#if SOC_GPIO_PIN_COUNT > 32
+        if (pin >= 32) {
+          high |= 1UL << (pin - 32);
+          return;
+        }
+#endif
+        low |= 1UL << pin;
+      }
+
+      __attribute__((always_inline)) inline void add(const GPIOMask& mask) {
+        low |= mask.low;
+#if SOC_GPIO_PIN_COUNT > 32
+        high |= mask.high;
+#endif
+      }
+
+      __attribute__((always_inline)) inline bool empty() const {
+#if SOC_GPIO_PIN_COUNT > 32
+        return !low && !high;
+#else
+        return !low;
+#endif
+      }
+
+      /**
+       * @brief Set all the GPIOs of the mask HIGH at once
+       */
+      __attribute__((always_inline)) inline void setHigh() const {
+        if (low)
+          REG_WRITE(GPIO_OUT_W1TS_REG, low);
+#if SOC_GPIO_PIN_COUNT > 32
+        if (high)
+          REG_WRITE(GPIO_OUT1_W1TS_REG, high);
+#endif
+      }
+
+      /**
+       * @brief Set all the GPIOs of the mask LOW at once
+       */
+      __attribute__((always_inline)) inline void setLow() const {
+        if (low)
+          REG_WRITE(GPIO_OUT_W1TC_REG, low);
+#if SOC_GPIO_PIN_COUNT > 32
+        if (high)
+          REG_WRITE(GPIO_OUT1_W1TC_REG, high);
+#endif
+      }
+  };
+} // namespace Mycila
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "i2c_worker.h"
+
+#include "dimmer_registry.h"
+
+// task
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <condition_variable>
+#include <mutex>
+
+// logging
+#include <esp32-hal-log.h>
+
+#define TAG "DimmerI2C"
+
+using Mycila::I2CWorker;
+
+// the lock is always used, whatever MYCILA_DIMMER_NO_LOCK: the writes happen in the worker task, concurrently with the attachments
+// it is never held while calling the clients, so that they can attach or detach clients from onWrite()
+static std::mutex mutex; // clients and current
+static std::condition_variable idle; // notified when the worker is done with a client
+static Mycila::DimmerRegistry<I2CWorker::Client, MYCILA_DIMMER_I2C_WORKER_MAX_CLIENTS> clients;
+static I2CWorker::Client* current = nullptr; // client being called by the worker, under the lock
+static std::atomic<TaskHandle_t> task{nullptr};
+
+static void run(void*) {
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // the clients can change while one of them is called: loop until a whole pass finds no pending client
+    bool called = true;
+    while (called) {
+      // stopped with the last client, or replaced by a new task
+      if (task.load() != xTaskGetCurrentTaskHandle()) {
+        lock.unlock();
+        vTaskDelete(nullptr);
+        return;
+      }
+
+      called = false;
+      for (size_t i = 0; i < clients.size(); i++) {
+        I2CWorker::Client* client = clients[i];
+        if (!client->pending.exchange(false))
+          continue;
+        current = client;
+        lock.unlock();
+        client->onWrite(client->arg);
+        lock.lock();
+        current = nullptr;
+        idle.notify_all();
+        called = true;
+      }
+    }
+  }
+}
+
+bool I2CWorker::attach(Client& client) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (clients.full()) {
+    ESP_LOGE(TAG, "Unable to attach I2C client %p: maximum of %d clients reached", &client, MYCILA_DIMMER_I2C_WORKER_MAX_CLIENTS);
+    return false;
+  }
+
+  if (clients.empty()) {
+    ESP_LOGI(TAG, "Starting I2C worker");
+    TaskHandle_t handle = nullptr;
+    if (xTaskCreate(run, "dimmer_i2c", MYCILA_DIMMER_I2C_WORKER_STACK_SIZE, nullptr, MYCILA_DIMMER_I2C_WORKER_PRIORITY, &handle) != pdPASS) {
+      ESP_LOGE(TAG, "Unable to create the I2C worker task");
+      return false;
+    }
+    task.store(handle);
+  }
+
+  ESP_LOGD(TAG, "Attach I2C client %p", &client);
+  client.pending.store(false);
+  clients.add(&client);
+  return true;
+}
+
+void I2CWorker::detach(Client& client) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // waits for the ongoing write of any client (a client can write for its sibling), unless called from a write of the worker itself
+  if (task.load() != xTaskGetCurrentTaskHandle())
+    idle.wait(lock, [] { return current == nullptr; });
+
+  if (!clients.remove(&client))
+    return;
+
+  ESP_LOGD(TAG, "Detach I2C client %p", &client);
+  client.pending.store(false);
+
+  if (clients.empty()) {
+    ESP_LOGI(TAG, "Stopping I2C worker");
+    // the task deletes itself once woken up
+    TaskHandle_t handle = task.exchange(nullptr);
+    if (handle != nullptr)
+      xTaskNotifyGive(handle);
+  }
+}
+
+void I2CWorker::notify(Client& client) {
+  client.pending.store(true);
+  TaskHandle_t handle = task.load();
+  if (handle != nullptr)
+    xTaskNotifyGive(handle);
+}
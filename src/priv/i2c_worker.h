@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Background task sending the I2C writes of the dimmers, so that the task updating a duty cycle never waits for the bus.
+ *
+ * - Clients only flag that they have a new value to send: the worker then calls them once, whatever the number of updates in between,
+ *   so that only the latest value of each client is written.
+ * - The task is created with the first client and deleted with the last one.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Maximum number of clients of the I2C worker (one per DFRobot dimmer in asynchronous mode)
+#ifndef MYCILA_DIMMER_I2C_WORKER_MAX_CLIENTS
+  #define MYCILA_DIMMER_I2C_WORKER_MAX_CLIENTS 8
+#endif
+
+#ifndef MYCILA_DIMMER_I2C_WORKER_STACK_SIZE
+  #define MYCILA_DIMMER_I2C_WORKER_STACK_SIZE 3072
+#endif
+
+#ifndef MYCILA_DIMMER_I2C_WORKER_PRIORITY
+  #define MYCILA_DIMMER_I2C_WORKER_PRIORITY 1
+#endif
+
+namespace Mycila {
+  class I2CWorker {
+    public:
+      struct Client {
+          // called from the worker task to send the latest value of the client, without the worker lock: it can attach or detach clients
+          void (*onWrite)(void* arg) = nullptr;
+          void* arg = nullptr;
+          std::atomic<bool> pending{false}; // only accessed by the worker
+      };
+
+      /**
+       * @brief Attach a client to the worker, which is started with the first client
+       * @return false if there are already MYCILA_DIMMER_I2C_WORKER_MAX_CLIENTS clients or if the task cannot be created
+       */
+      static bool attach(Client& client);
+
+      /**
+       * @brief Detach a client from the worker, which is stopped with the last client
+       * @n Waits for the ongoing write, if any: onWrite() is not called anymore once this function returns.
+       * @n When called from onWrite() (worker task), it does not wait: the worker is done with the client once onWrite() returns.
+       */
+      static void detach(Client& client);
+
+      /**
+       * @brief Request the worker to call onWrite() of an attached client (never blocks)
+       */
+      static void notify(Client& client);
+  };
+} // namespace Mycila
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Minimal MessagePack encoder writing into a caller-provided buffer, used to serialize the dimmer snapshots.
+ *
+ * Only the types needed by the library are supported (nil, unsigned integers and arrays).
+ * Writes past the end of the buffer are dropped and flagged: size() then returns 0.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Mycila {
+  class MsgPackWriter {
+    public:
+      MsgPackWriter(uint8_t* buffer, size_t size) : _buffer(buffer), _capacity(buffer ? size : 0) {}
+
+      void nil() { _put(0xc0); }
+
+      void array(uint16_t count) {
+        if (count < 16) {
+          _put(0x90 | count);
+        } else {
+          _put(0xdc);
+          _put16(count);
+        }
+      }
+
+      void uint(uint32_t value) {
+        if (value < 128) {
+          _put(value);
+        } else if (value <= UINT8_MAX) {
+          _put(0xcc);
+          _put(value);
+        } else if (value <= UINT16_MAX) {
+          _put(0xcd);
+          _put16(value);
+        } else {
+          _put(0xce);
+          _put16(value >> 16);
+          _put16(value);
+        }
+      }
+
+      // number of bytes written, or 0 if the buffer was too small
+      size_t size() const { return _overflow ? 0 : _position; }
+
+    private:
+      uint8_t* _buffer;
+      size_t _capacity;
+      size_t _position = 0;
+      bool _overflow = false;
+
+      void _put(uint8_t byte) {
+        if (_position < _capacity)
+          _buffer[_position++] = byte;
+        else
+          _overflow = true;
+      }
+
+      // big-endian, as required by MessagePack
+      void _put16(uint16_t value) {
+        _put(value >> 8);
+        _put(value);
+      }
+  };
+} // namespace Mycila
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Power LUTs of the phase control dimmers, generated at compile time.
+ *
+ * - FiringDelays maps a power duty cycle to a TRIAC firing delay ratio, by inverting the sine square CDF
+ *   (same algorithm as tools/lut.py, which can still be used to inspect or validate a table).
+ * - PowerRatios is its counterpart: it maps a conduction duty cycle to the power ratio (sine square CDF).
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Mycila {
+  namespace LUT {
+    constexpr double PI = 3.14159265358979323846;
+
+    // sin(x) for x in [0, 2π], usable in constant expressions
+    constexpr double sin(double x) {
+      // reduce to [-π, π] where the Taylor series quickly converges
+      if (x > PI)
+        x -= 2 * PI;
+      const double x2 = x * x;
+      double term = x;
+      double sum = x;
+      for (int i = 1; i < 16; i++) {
+        term *= -x2 / ((2 * i) * (2 * i + 1));
+        sum += term;
+      }
+      return sum;
+    }
+
+    // TRIAC firing delay ratio [0,1] to power ratio [0,1] (sine square CDF)
+    constexpr double phase2duty(double phase) { return sin(2 * PI * phase) / (2 * PI) - phase + 1; }
+
+    // Power duty ratio [0,1] to TRIAC firing delay ratio [0,1]: inverse of the sine square CDF using bisection
+    constexpr double duty2phase(double duty) {
+      if (duty <= 0)
+        return 1.0;
+      if (duty >= 1)
+        return 0.0;
+      double low = 0.0;
+      double high = 1.0;
+      for (int i = 0; i < 32; i++) { // 32 iterations gives us ~10^-9 precision
+        const double phase = (low + high) / 2;
+        if (duty > phase2duty(phase))
+          high = phase;
+        else
+          low = phase;
+      }
+      return (low + high) / 2;
+    }
+
+    /**
+     * @brief Lookup table of the firing delays, as 16-bit ratios of the semi-period, for LEN power duty cycles evenly spread in [0, 1]
+     *
+     * @tparam LEN: number of entries in the table (flash usage: 2 bytes per entry)
+     * @tparam RESOLUTION: number of bits the duty cycle is quantized to before interpolating between 2 entries (up to 16)
+     */
+    template <size_t LEN, uint32_t RESOLUTION>
+    class FiringDelays {
+        static_assert(LEN >= 2, "The power LUT must have at least 2 entries");
+        static_assert(RESOLUTION >= 1 && RESOLUTION <= 16, "The power LUT resolution must be in [1, 16] bits");
+        static_assert((LEN - 1) * 65536ULL <= UINT32_MAX, "The power LUT is too large: the interpolation slot must fit in 32 bits");
+
+      public:
+        static constexpr size_t SIZE = LEN;
+        static constexpr uint32_t DUTY_MAX = (1UL << RESOLUTION) - 1;
+        static constexpr uint32_t SCALE = (LEN - 1U) * (1UL << (16 - RESOLUTION));
+        // half a quantization step, added to round the duty cycle to the nearest step (0 at 16 bits: no quantization)
+        static constexpr uint32_t ROUNDING = (1UL << (16 - RESOLUTION)) >> 1;
+
+        constexpr FiringDelays() {
+          for (size_t i = 0; i < LEN; i++)
+            _delays[i] = static_cast<uint16_t>(duty2phase(static_cast<double>(i) / (LEN - 1)) * 0xFFFF);
+        }
+
+        constexpr uint16_t operator[](size_t index) const { return _delays[index]; }
+
+        /**
+         * @brief Get the firing delay for a duty cycle in ]0, 1[, by linear interpolation between the 2 closest entries (integer math only)
+         * @param dutyCycle: the duty cycle in Q16 (0xFFFF is 1)
+         * @return the firing delay as a 16-bit ratio of the semi-period
+         */
+        uint16_t lookup(uint16_t dutyCycle) const {
+          // round to the nearest step (32-bit math: no overflow), the duty cycles above the last step being clamped to it
+          uint32_t duty = (static_cast<uint32_t>(dutyCycle) + ROUNDING) >> (16 - RESOLUTION);
+          if (duty > DUTY_MAX)
+            duty = DUTY_MAX;
+          uint32_t slot = duty * SCALE;
+          uint32_t index = slot >> 16;
+          uint32_t a = _delays[index];
+          uint32_t b = _delays[index + 1];
+          return a - (((a - b) * (slot & 0xffff)) >> 16); // interpolate a b
+        }
+
+      private:
+        uint16_t _delays[LEN] = {};
+    };
+
+    /**
+     * @brief Lookup table of the power ratios, as 16-bit ratios, for LEN conduction duty cycles evenly spread in [0, 1]
+     *
+     * @tparam LEN: number of entries in the table (flash usage: 2 bytes per entry)
+     */
+    template <size_t LEN>
+    class PowerRatios {
+        static_assert(LEN >= 2, "The power LUT must have at least 2 entries");
+
+      public:
+        static constexpr size_t SIZE = LEN;
+
+        constexpr PowerRatios() {
+          for (size_t i = 0; i < LEN; i++)
+            _ratios[i] = static_cast<uint16_t>(phase2duty(1.0 - static_cast<double>(i) / (LEN - 1)) * 0xFFFF + 0.5);
+        }
+
+        constexpr uint16_t operator[](size_t index) const { return _ratios[index]; }
+
+        /**
+         * @brief Get the power ratio in [0, 1] for a conduction duty cycle in [0, 1], by linear interpolation between the 2 closest entries
+         */
+        float lookup(float dutyCycle) const {
+          if (dutyCycle <= 0)
+            return 0;
+          const float slot = dutyCycle * (LEN - 1);
+          const size_t index = static_cast<size_t>(slot);
+          if (index >= LEN - 1)
+            return 1;
+          const float a = _ratios[index];
+          const float b = _ratios[index + 1];
+          return (a + (b - a) * (slot - static_cast<float>(index))) * (1.0f / 0xFFFF);
+        }
+
+      private:
+        uint16_t _ratios[LEN] = {};
+    };
+  } // namespace LUT
+} // namespace Mycila
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Linear ramp of a dimmer setpoint (firing delay, duty_milli...) advanced by the firing ISRs at each semi-period.
+ *
+ * - Ramp is built from task context and published to the ISR with the dimmer states.
+ * - RampState is only written by the ISR, which advances it with fixed-point math (Q16.16), so that no float is used in the ISR.
+ *
+ * A new ramp is detected by its id: the ISR restarts from the ramp start value when the id changes,
+ * so that states can be republished (for example when another dimmer is updated) without restarting an ongoing ramp.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace Mycila {
+  struct Ramp {
+      uint32_t id = 0;    // 0: no ramp
+      int32_t start = 0;  // Q16.16
+      int32_t target = 0; // Q16.16
+      int32_t step = 0;   // Q16.16 increment per semi-period
+
+      bool active() const { return id != 0; }
+
+      /**
+       * @brief Ramp linearly from a start value to a target value (both Q16.16) in a number of semi-periods
+       * @warning Values must be lower than 32768 to fit in Q16.16
+       */
+      void set(uint32_t rampId, int32_t from, int32_t to, uint32_t semiPeriods) {
+        id = rampId;
+        start = from;
+        target = to;
+        step = (target - start) / static_cast<int32_t>(semiPeriods ? semiPeriods : 1);
+        if (step == 0)
+          step = target > start ? 1 : -1;
+      }
+  };
+
+  struct RampState {
+      uint32_t id = 0;
+      int32_t value = 0; // Q16.16
+
+      /**
+       * @brief Returns true once the ISR has advanced the ramp up to its target
+       */
+      bool reached(const Ramp& ramp) const { return id == ramp.id && value == ramp.target; }
+
+      /**
+       * @brief Returns true if the ISR is advancing this ramp
+       */
+      bool running(const Ramp& ramp) const { return ramp.active() && id == ramp.id && value != ramp.target; }
+
+      /**
+       * @brief Advance the ramp by one semi-period and get the current setpoint in Q16.16 (forced inline to be used from ISR in IRAM)
+       */
+      __attribute__((always_inline)) inline int32_t step(const Ramp& ramp) {
+        if (id != ramp.id) {
+          id = ramp.id;
+          value = ramp.start;
+        }
+        if (ramp.step > 0) {
+          value = ramp.target - value > ramp.step ? value + ramp.step : ramp.target;
+        } else {
+          value = value - ramp.target > -ramp.step ? value + ramp.step : ramp.target;
+        }
+        return value;
+      }
+
+      /**
+       * @brief Advance the ramp by one semi-period and get the current setpoint rounded to an integer (forced inline to be used from ISR in IRAM)
+       */
+      __attribute__((always_inline)) inline uint16_t advance(const Ramp& ramp) { return static_cast<uint16_t>((step(ramp) + 0x8000) >> 16); }
+  };
+} // namespace Mycila
@@ -0,0 +1,305 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "timer_service.h"
+
+// lock
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <mutex>
+
+// gpio
+#include <driver/gptimer_types.h>
+#include <esp32-hal-gpio.h>
+#include <esp_idf_version.h>
+#include <esp_memory_utils.h>
+
+// logging
+#include <esp32-hal-log.h>
+
+#include "inlined_gptimer.h"
+
+// The alarm is never set closer than this to the current count, so that it cannot be reached while being written: closer events are up to 2 us late
+#define ALARM_MARGIN_TICKS (2 * Mycila::TimerService::TICKS_PER_US)
+
+#define TAG "DimmerTimer"
+
+using Mycila::TimerService;
+
+// created with the first client and kept for the next ones: it is only stopped when there is no client, so that the ISRs never use a deleted timer
+static gptimer_handle_t timer = nullptr;
+static std::atomic<bool> running{false};
+
+// only taken from task context to serialize the attachments
+#ifndef MYCILA_DIMMER_NO_LOCK
+static std::mutex clients_mutex;
+#endif
+
+// clients, scanned without lock by the ISRs: a slot is set when a client is attached and cleared when it is detached
+static std::atomic<TimerService::Client*> clients[MYCILA_DIMMER_TIMER_MAX_CLIENTS];
+static size_t client_count = 0; // task context only
+
+// Events are stored in 32-bit words, which are atomic on all the targets (64-bit atomics are not lock-free):
+// bit 0 is set for a scheduled event and bits 1-31 hold the low 31 bits of its timer count.
+// They are compared through their difference, which is valid while the events are less than 2^30 ticks (26 s at 40 MHz) away from the current count.
+#define NO_EVENT 0
+
+static inline uint32_t ARDUINO_ISR_ATTR encode(uint64_t time) { return (static_cast<uint32_t>(time) << 1) | 1; }
+static inline bool ARDUINO_ISR_ATTR before(uint32_t a, uint32_t b) { return static_cast<int32_t>(a - b) < 0; }
+static inline uint64_t ARDUINO_ISR_ATTR decode(uint32_t event, uint64_t now) { return now + static_cast<int32_t>(event - encode(now)) / 2; }
+
+// only held to move the alarm: the event on which the alarm is set is only written with the spinlock held, or cleared by the timer ISR when the alarm fires
+static portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<uint32_t> armed{NO_EVENT};
+
+// set the alarm on the earliest pending event: caller must hold the spinlock
+static void ARDUINO_ISR_ATTR arm() {
+  uint64_t now = 0;
+  if (inlined_gptimer_get_raw_count(timer, &now) != ESP_OK)
+    return;
+
+  uint32_t earliest = NO_EVENT;
+  for (size_t i = 0; i < MYCILA_DIMMER_TIMER_MAX_CLIENTS; i++) {
+    TimerService::Client* client = clients[i].load();
+    if (client == nullptr)
+      continue;
+    const uint32_t event = client->event.load();
+    if (event != NO_EVENT && event != client->dispatched.load() && (earliest == NO_EVENT || before(event, earliest)))
+      earliest = event;
+  }
+  armed.store(earliest);
+
+  if (earliest == NO_EVENT) {
+    inlined_gptimer_set_alarm_action(timer, nullptr);
+    return;
+  }
+
+  gptimer_alarm_config_t alarm_cfg = {.alarm_count = decode(earliest, now), .reload_count = 0, .flags = {.auto_reload_on_alarm = false}};
+  if (alarm_cfg.alarm_count < now + ALARM_MARGIN_TICKS)
+    alarm_cfg.alarm_count = now + ALARM_MARGIN_TICKS;
+  inlined_gptimer_set_alarm_action(timer, &alarm_cfg);
+}
+
+// Timer ISR: dispatch all the events which are due, until the next one is in the future
+static bool ARDUINO_ISR_ATTR dispatch(gptimer_handle_t, const gptimer_alarm_event_data_t*, void*) {
+  // the alarm is consumed: the clients scheduling an event from now on move the alarm by themselves, until it is set again below
+  armed.store(NO_EVENT);
+
+  while (running.load(std::memory_order_acquire)) {
+    uint64_t now = 0;
+    if (inlined_gptimer_get_raw_count(timer, &now) != ESP_OK)
+      return false;
+
+    // the events are marked as dispatched instead of being cleared, so that the event slots are only written by their clients
+    bool due = false;
+    const uint32_t current = encode(now);
+    for (size_t i = 0; i < MYCILA_DIMMER_TIMER_MAX_CLIENTS; i++) {
+      TimerService::Client* client = clients[i].load();
+      if (client == nullptr)
+        continue;
+      const uint32_t event = client->event.load();
+      if (event != NO_EVENT && event != client->dispatched.load() && !before(current, event)) {
+        client->dispatched.store(event);
+        client->onEvent(client->arg);
+        due = true;
+      }
+    }
+
+    if (!due) {
+      portENTER_CRITICAL_SAFE(&spinlock);
+      arm();
+      portEXIT_CRITICAL_SAFE(&spinlock);
+      return false;
+    }
+  }
+  return false;
+}
+
+// create and enable the timer: its interrupt is allocated on the calling core
+static void createTimer(void* arg) {
+  gptimer_config_t timer_config;
+  timer_config.clk_src = GPTIMER_CLK_SRC_DEFAULT;
+  timer_config.direction = GPTIMER_COUNT_UP;
+  timer_config.resolution_hz = MYCILA_DIMMER_TIMER_RESOLUTION_HZ;
+  timer_config.flags.intr_shared = MYCILA_DIMMER_TIMER_INTR_SHARED;
+  timer_config.intr_priority = MYCILA_DIMMER_TIMER_INTR_PRIORITY;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+  timer_config.flags.backup_before_sleep = false;
+#endif
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
+  timer_config.flags.allow_pd = false;
+#endif
+
+  gptimer_event_callbacks_t callbacks_config;
+  callbacks_config.on_alarm = dispatch;
+
+  gptimer_handle_t* handle = static_cast<gptimer_handle_t*>(arg);
+  ESP_ERROR_CHECK(gptimer_new_timer(&timer_config, handle));
+  ESP_ERROR_CHECK(gptimer_register_event_callbacks(*handle, &callbacks_config, nullptr));
+  ESP_ERROR_CHECK(gptimer_enable(*handle));
+}
+
+#if !CONFIG_FREERTOS_UNICORE && MYCILA_DIMMER_TIMER_CORE >= 0
+struct CoreCall {
+    void (*fn)(void*);
+    void* arg;
+    SemaphoreHandle_t done;
+};
+
+static void coreCallTask(void* param) {
+  CoreCall* call = static_cast<CoreCall*>(param);
+  call->fn(call->arg);
+  xSemaphoreGive(call->done);
+  vTaskDelete(nullptr);
+}
+#endif
+
+// run a timer function on MYCILA_DIMMER_TIMER_CORE, through a temporary task pinned to this core when called from the other one
+static void runOnTimerCore(void (*fn)(void*), void* arg) {
+#if !CONFIG_FREERTOS_UNICORE && MYCILA_DIMMER_TIMER_CORE >= 0
+  if (xPortGetCoreID() != MYCILA_DIMMER_TIMER_CORE) {
+    CoreCall call = {.fn = fn, .arg = arg, .done = xSemaphoreCreateBinary()};
+    if (call.done != nullptr) {
+      if (xTaskCreatePinnedToCore(coreCallTask, "dimmer_timer", 4096, &call, uxTaskPriorityGet(nullptr), nullptr, MYCILA_DIMMER_TIMER_CORE) == pdPASS) {
+        xSemaphoreTake(call.done, portMAX_DELAY);
+        vSemaphoreDelete(call.done);
+        return;
+      }
+      vSemaphoreDelete(call.done);
+    }
+    ESP_LOGE(TAG, "Unable to run on core %d: using core %d for the firing timer", MYCILA_DIMMER_TIMER_CORE, xPortGetCoreID());
+  }
+#endif
+  fn(arg);
+}
+
+bool TimerService::checkISR([[maybe_unused]] const char* name, const void* isr) {
+  if (esp_ptr_in_iram(isr))
+    return true;
+  ESP_LOGW(TAG, "%s is not in IRAM: the dimmers will stop firing during the flash operations (set CONFIG_ARDUINO_ISR_IRAM=1)", name);
+  return false;
+}
+
+bool TimerService::attach(Client& client) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(clients_mutex);
+#endif
+
+  if (client_count >= MYCILA_DIMMER_TIMER_MAX_CLIENTS) {
+    ESP_LOGE(TAG, "Unable to attach timer client %p: maximum of %d clients reached", &client, MYCILA_DIMMER_TIMER_MAX_CLIENTS);
+    return false;
+  }
+
+  ESP_LOGD(TAG, "Attach timer client %p", &client);
+
+  checkISR("Timer client event callback", reinterpret_cast<const void*>(client.onEvent));
+  if (client.onZeroCross != nullptr)
+    checkISR("Timer client ZC callback", reinterpret_cast<const void*>(client.onZeroCross));
+
+  client.event.store(NO_EVENT);
+  client.dispatched.store(NO_EVENT);
+  for (size_t i = 0; i < MYCILA_DIMMER_TIMER_MAX_CLIENTS; i++) {
+    if (clients[i].load() == nullptr) {
+      clients[i].store(&client);
+      break;
+    }
+  }
+
+  if (client_count++ == 0) {
+    ESP_LOGI(TAG, "Starting shared firing timer (priority: %d, shared: %d, core: %d)", MYCILA_DIMMER_TIMER_INTR_PRIORITY, MYCILA_DIMMER_TIMER_INTR_SHARED, MYCILA_DIMMER_TIMER_CORE);
+
+    if (timer == nullptr) {
+      // without these options, the timer interrupt is disabled while the cache is disabled, whatever the placement of the ISRs
+#ifndef CONFIG_GPTIMER_ISR_IRAM_SAFE
+      ESP_LOGW(TAG, "CONFIG_GPTIMER_ISR_IRAM_SAFE is not set: the dimmers will stop firing during the flash operations");
+#endif
+      checkISR("Firing timer ISR", reinterpret_cast<const void*>(&dispatch));
+      checkISR("ZC ISR", reinterpret_cast<const void*>(&TimerService::zeroCross));
+
+      runOnTimerCore(createTimer, &timer);
+    }
+
+    ESP_ERROR_CHECK(gptimer_start(timer));
+    armed.store(NO_EVENT);
+    running.store(true, std::memory_order_release);
+  }
+
+  return true;
+}
+
+void TimerService::detach(Client& client) {
+#ifndef MYCILA_DIMMER_NO_LOCK
+  std::lock_guard<std::mutex> lock(clients_mutex);
+#endif
+
+  for (size_t i = 0; i < MYCILA_DIMMER_TIMER_MAX_CLIENTS; i++) {
+    if (clients[i].load() == &client) {
+      ESP_LOGD(TAG, "Detach timer client %p", &client);
+      clients[i].store(nullptr);
+      client.event.store(NO_EVENT);
+      if (--client_count == 0) {
+        ESP_LOGI(TAG, "Stopping shared firing timer");
+        // the timer is kept (and its count with it) for the next clients: the ISRs racing with this call still read a valid timer
+        running.store(false, std::memory_order_release);
+        portENTER_CRITICAL(&spinlock);
+        armed.store(NO_EVENT);
+        inlined_gptimer_set_alarm_action(timer, nullptr);
+        portEXIT_CRITICAL(&spinlock);
+        gptimer_stop(timer);
+      }
+      return;
+    }
+  }
+}
+
+bool ARDUINO_ISR_ATTR TimerService::now(uint64_t& count) {
+  return running.load(std::memory_order_acquire) && inlined_gptimer_get_raw_count(timer, &count) == ESP_OK;
+}
+
+bool ARDUINO_ISR_ATTR TimerService::schedule(Client& client, uint64_t time) {
+  uint64_t now;
+  return TimerService::now(now) && schedule(client, time, now);
+}
+
+bool ARDUINO_ISR_ATTR TimerService::schedule(Client& client, uint64_t time, uint64_t now) {
+  if (time <= now) {
+    client.event.store(NO_EVENT);
+    return false;
+  }
+
+  const uint32_t event = encode(time);
+  client.event.store(event);
+
+  // the alarm only has to be moved if this is the new earliest event: a later event is found by the dispatch of the armed one
+  uint32_t current = armed.load();
+  if (current == NO_EVENT || before(event, current)) {
+    portENTER_CRITICAL_SAFE(&spinlock);
+    current = armed.load();
+    if (running.load(std::memory_order_relaxed) && (current == NO_EVENT || before(event, current)))
+      arm();
+    portEXIT_CRITICAL_SAFE(&spinlock);
+  }
+
+  return true;
+}
+
+void ARDUINO_ISR_ATTR TimerService::cancel(Client& client) {
+  client.event.store(NO_EVENT);
+}
+
+void ARDUINO_ISR_ATTR TimerService::zeroCross(int16_t delayUntilZero) {
+  // the ZC event is timestamped once for all the listeners
+  uint64_t now;
+  if (!TimerService::now(now))
+    return;
+
+  for (size_t i = 0; i < MYCILA_DIMMER_TIMER_MAX_CLIENTS; i++) {
+    Client* client = clients[i].load();
+    if (client != nullptr && client->onZeroCross != nullptr)
+      client->onZeroCross(client->arg, delayUntilZero, now);
+  }
+}
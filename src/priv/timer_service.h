@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Timer scheduler shared by all the ZC-driven dimmers (thyristor groups, cycle stealing dimmers).
+ *
+ * - A single gptimer counts forever (it is never reset) and has one alarm, set to the earliest event of all the clients.
+ * - Clients schedule events at absolute timer counts: when the alarm fires, all the clients whose event is due are dispatched in the same interrupt.
+ * - zeroCross() reads the timer once and fans the ZC event out to the clients listening to the default ZCD.
+ *
+ * Clients are attached / detached from task context (the timer is started with the first client and stopped with the last one).
+ * The timer interrupt is installed on MYCILA_DIMMER_TIMER_CORE, with MYCILA_DIMMER_TIMER_INTR_PRIORITY and MYCILA_DIMMER_TIMER_INTR_SHARED.
+ * All the other functions are IRAM safe and can be called from ISRs, concurrently from both cores:
+ * - each client has its own event slot, only written by the client itself, and scanned without lock by the timer ISR
+ * - a critical section is only taken to move the alarm, when an event earlier than the armed one is scheduled, or at the end of a dispatch
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Resolution in Hz of the shared firing timer: 1 MHz gives 1 us steps, 10 or 40 MHz give a finer power granularity at low duty cycles.
+// Must be a multiple of 1 MHz which divides the 80 MHz APB clock (1, 2, 4, 5, 8, 10, 16, 20, 40 MHz).
+#ifndef MYCILA_DIMMER_TIMER_RESOLUTION_HZ
+  #define MYCILA_DIMMER_TIMER_RESOLUTION_HZ 1000000
+#endif
+
+// Maximum number of clients of the shared firing timer: each thyristor group with dimmers is a client, and all the cycle stealing dimmers are one client
+#ifndef MYCILA_DIMMER_TIMER_MAX_CLIENTS
+  #define MYCILA_DIMMER_TIMER_MAX_CLIENTS 8
+#endif
+
+// Interrupt priority of the shared firing timer: 1 (low) to 3 (medium), or 0 to let the driver pick a free low / medium level
+#ifndef MYCILA_DIMMER_TIMER_INTR_PRIORITY
+  #define MYCILA_DIMMER_TIMER_INTR_PRIORITY 0
+#endif
+
+// Set to 0 to reserve a CPU interrupt for the shared firing timer, instead of sharing it with other peripherals at the same level
+#ifndef MYCILA_DIMMER_TIMER_INTR_SHARED
+  #define MYCILA_DIMMER_TIMER_INTR_SHARED 1
+#endif
+
+// Core on which the interrupt of the shared firing timer is installed, or -1 for the core of the task calling begin() (ignored on single core chips)
+#ifndef MYCILA_DIMMER_TIMER_CORE
+  #define MYCILA_DIMMER_TIMER_CORE -1
+#endif
+
+namespace Mycila {
+  class TimerService {
+    public:
+      // number of timer ticks per us
+      static constexpr uint32_t TICKS_PER_US = MYCILA_DIMMER_TIMER_RESOLUTION_HZ / 1000000;
+      static_assert(TICKS_PER_US > 0 && TICKS_PER_US * 1000000 == MYCILA_DIMMER_TIMER_RESOLUTION_HZ && 80 % TICKS_PER_US == 0, "MYCILA_DIMMER_TIMER_RESOLUTION_HZ must be a multiple of 1 MHz dividing 80 MHz");
+
+      static_assert(MYCILA_DIMMER_TIMER_INTR_PRIORITY >= 0 && MYCILA_DIMMER_TIMER_INTR_PRIORITY <= 3, "MYCILA_DIMMER_TIMER_INTR_PRIORITY must be between 0 and 3");
+      static_assert(MYCILA_DIMMER_TIMER_CORE >= -1 && MYCILA_DIMMER_TIMER_CORE <= 1, "MYCILA_DIMMER_TIMER_CORE must be -1, 0 or 1");
+
+      struct Client {
+          // called from the timer ISR when the scheduled event is due
+          void (*onEvent)(void* arg) = nullptr;
+          // called from zeroCross() with the timer count of the ZC event, or nullptr if the client has its own ZCD
+          void (*onZeroCross)(void* arg, int16_t delayUntilZero, uint64_t zcTime) = nullptr;
+          void* arg = nullptr;
+          // only accessed by the service: scheduled event, only written by the client (schedule(), cancel()), and last dispatched event, only written by the timer ISR
+          std::atomic<uint32_t> event{0};
+          std::atomic<uint32_t> dispatched{0};
+      };
+
+      /**
+       * @brief Attach a client to the shared timer, which is started with the first client (task context only)
+       * @return false if there are already MYCILA_DIMMER_TIMER_MAX_CLIENTS clients
+       */
+      static bool attach(Client& client);
+
+      /**
+       * @brief Detach a client from the shared timer, which is stopped with the last client (task context only)
+       * @warning The client event callback can still be running on the other core when this function returns
+       */
+      static void detach(Client& client);
+
+      /**
+       * @brief Check that an ISR entry point is in IRAM, so that it keeps running during the flash operations (task context only)
+       * @return false (and log a warning) if the function is in flash
+       */
+      static bool checkISR(const char* name, const void* isr);
+
+      /**
+       * @brief Get the current timer count
+       * @return false if the timer is not running (no client)
+       */
+      static bool now(uint64_t& count);
+
+      /**
+       * @brief Schedule the next event of a client at an absolute timer count, replacing the previous one
+       * @return false if the event time is already reached: the caller has to process the event by itself
+       */
+      static bool schedule(Client& client, uint64_t time);
+
+      /**
+       * @brief Schedule the next event of a client, from a timer count just read by the caller with now() (saves a timer read in the ISRs)
+       * @return false if the event time is already reached: the caller has to process the event by itself
+       */
+      static bool schedule(Client& client, uint64_t time, uint64_t now);
+
+      /**
+       * @brief Cancel the scheduled event of a client (the alarm is not moved: if it was set on this event, it fires for nothing)
+       */
+      static void cancel(Client& client);
+
+      /**
+       * @brief Dispatch a ZC event of the default ZCD to all the clients listening to it
+       */
+      static void zeroCross(int16_t delayUntilZero);
+  };
+} // namespace Mycila
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Lock-free triple buffer used to publish dimmer states from tasks to the firing ISRs.
+ *
+ * - The writer (task context, serialized by the caller) builds a new state in a free buffer and publishes it.
+ * - The reader (ISR) picks the latest published state when it starts a new semi-period and never blocks.
+ *
+ * Only atomic loads and stores are used (no read-modify-write), so that nothing ends up in a library call
+ * on targets without atomic instructions, and all the reader functions are forced inline to be IRAM safe.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Mycila {
+  template <typename T>
+  class TripleBuffer {
+    public:
+      ////////////
+      // WRITER //
+      ////////////
+
+      /**
+       * @brief Get a buffer which is neither used by the reader nor published, to build the next state into.
+       * @warning The returned buffer contains an old state and must be entirely rewritten before being published.
+       */
+      T& back() {
+        const uint8_t published = _published.load();
+        const uint8_t reading = _reading.load();
+        _back = 0;
+        while (_back == published || _back == reading)
+          _back++;
+        return _buffers[_back];
+      }
+
+      /**
+       * @brief Publish the buffer returned by the last call to back(): the reader will use it from its next acquire()
+       */
+      void publish() { _published.store(_back); }
+
+      /**
+       * @brief Returns true if the reader has started using the last published state
+       */
+      bool consumed() const { return _reading.load() == _published.load(); }
+
+      ////////////
+      // READER //
+      ////////////
+
+      /**
+       * @brief Start using the latest published state
+       */
+      __attribute__((always_inline)) inline const T& acquire() {
+        uint8_t published;
+        do {
+          // advertise the buffer we are going to read, then make sure it was not replaced in the meantime
+          published = _published.load();
+          _reading.store(published);
+        } while (_published.load() != published);
+        return _buffers[published];
+      }
+
+      /**
+       * @brief Get the state currently used by the reader
+       */
+      __attribute__((always_inline)) inline const T& front() const { return _buffers[_reading.load(std::memory_order_relaxed)]; }
+
+    private:
+      T _buffers[3] = {};
+      std::atomic<uint8_t> _published = {0}; // last buffer published by the writer
+      std::atomic<uint8_t> _reading = {0};   // buffer currently used by the reader
+      uint8_t _back = 1;                     // buffer owned by the writer
+  };
+} // namespace Mycila
@@ -0,0 +1,279 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Micro-benchmarks of the ZC and firing ISRs, run on the host with the HAL shim (see README.md)
+ *
+ * Reports the CPU cycles and instructions per ISR invocation for 1 to 32 dimmers.
+ * The numbers are not the ones of an ESP32, but they allow to compare the cost of the ISR hot paths between two versions of the library.
+ * A few behaviors of the ISRs which are not measured are checked before (see checkStartup()): the benchmark fails if one of them is broken.
+ */
+#include <MycilaDimmers.h>
+
+#include "shim/mock.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+#include <chrono>
+
+#define ITERATIONS 20000
+
+static const size_t DIMMER_COUNTS[] = {1, 2, 4, 8, 16, 32};
+
+// Counts the CPU cycles and instructions of the benchmarked code with the Linux perf events when available,
+// otherwise only the elapsed time is reported.
+class Counters {
+  public:
+    Counters() {
+#ifdef __linux__
+      _cycles = _open(PERF_COUNT_HW_CPU_CYCLES);
+      _instructions = _open(PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+    }
+
+    ~Counters() {
+#ifdef __linux__
+      if (_cycles >= 0)
+        close(_cycles);
+      if (_instructions >= 0)
+        close(_instructions);
+#endif
+    }
+
+    bool hasCycles() const { return _cycles >= 0; }
+    bool hasInstructions() const { return _instructions >= 0; }
+
+    void start() {
+#ifdef __linux__
+      _control(_cycles, PERF_EVENT_IOC_RESET);
+      _control(_instructions, PERF_EVENT_IOC_RESET);
+      _control(_cycles, PERF_EVENT_IOC_ENABLE);
+      _control(_instructions, PERF_EVENT_IOC_ENABLE);
+#endif
+      _start = std::chrono::steady_clock::now();
+    }
+
+    void stop() {
+      _elapsed = std::chrono::steady_clock::now() - _start;
+#ifdef __linux__
+      _control(_cycles, PERF_EVENT_IOC_DISABLE);
+      _control(_instructions, PERF_EVENT_IOC_DISABLE);
+#endif
+    }
+
+    uint64_t cycles() const { return _read(_cycles); }
+    uint64_t instructions() const { return _read(_instructions); }
+    uint64_t nanoseconds() const { return std::chrono::duration_cast<std::chrono::nanoseconds>(_elapsed).count(); }
+
+  private:
+    int _cycles = -1;
+    int _instructions = -1;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::duration _elapsed{};
+
+#ifdef __linux__
+    static int _open(uint64_t config) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static void _control(int fd, unsigned long request) {
+      if (fd >= 0)
+        ioctl(fd, request, 0);
+    }
+#endif
+
+    static uint64_t _read(int fd) {
+      uint64_t value = 0;
+#ifdef __linux__
+      if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value))
+        value = 0;
+#endif
+      return value;
+    }
+};
+
+struct Measure {
+    double cycles = 0;
+    double instructions = 0;
+    double nanoseconds = 0;
+
+    Measure operator-(const Measure& other) const { return {cycles - other.cycles, instructions - other.instructions, nanoseconds - other.nanoseconds}; }
+};
+
+static Counters counters;
+
+// run the function and get the counters per invocation
+template <typename F>
+static Measure measure(uint64_t invocations, F&& f) {
+  counters.start();
+  f();
+  counters.stop();
+  return {static_cast<double>(counters.cycles()) / invocations,
+          static_cast<double>(counters.instructions()) / invocations,
+          static_cast<double>(counters.nanoseconds()) / invocations};
+}
+
+static void report(const char* name, size_t dimmers, const Measure& m) {
+  printf("%-28s %7zu", name, dimmers);
+  if (counters.hasCycles())
+    printf(" %10.1f", m.cycles);
+  else
+    printf(" %10s", "n/a");
+  if (counters.hasInstructions())
+    printf(" %10.1f", m.instructions);
+  else
+    printf(" %10s", "n/a");
+  printf(" %10.1f\n", m.nanoseconds);
+}
+
+// 32 distinct output pins, with some of them on the second bank of GPIO registers
+static gpio_num_t pin(size_t index) { return static_cast<gpio_num_t>(2 + index); }
+
+// different duty cycles for all the dimmers, so that the firing schedule has one event per dimmer (worst case)
+static float duty(size_t index, size_t count) { return static_cast<float>(index + 1) / static_cast<float>(count + 1); }
+
+static void benchThyristor(size_t count) {
+  Mycila::ThyristorDimmer dimmers[32];
+  for (size_t i = 0; i < count; i++) {
+    dimmers[i].setPin(pin(i));
+    dimmers[i].begin();
+    dimmers[i].setOnline(true);
+    dimmers[i].setDutyCycle(duty(i, count));
+  }
+
+  gptimer_handle_t timer = mock_gptimer(mock_gptimer_count() - 1);
+
+  // ZC ISR: the ZC event is received 150us before the 0V crossing point, so the ISR only arms the first alarm
+  report("thyristor onZeroCross", count, measure(ITERATIONS, [] {
+    for (size_t i = 0; i < ITERATIONS; i++)
+      Mycila::ThyristorDimmer::onZeroCross(150, nullptr);
+  }));
+
+  // firing ISR: called once per firing event by the shared timer, after moving the timer to the alarm count.
+  // The ZC events are received at count 0, on the 0V crossing point, so the delays are the alarm counts.
+  // The cost of the ZC events and of moving the timer is measured separately and removed.
+  uint64_t delays[32];
+  for (size_t i = 0; i < count; i++)
+    delays[i] = dimmers[i].getFiringDelayTicks();
+
+  const Measure baseline = measure(ITERATIONS * count, [&] {
+    for (size_t i = 0; i < ITERATIONS; i++) {
+      gptimer_set_raw_count(timer, 0);
+      Mycila::ThyristorDimmer::onZeroCross(0, nullptr);
+      for (size_t j = count; j > 0; j--)
+        gptimer_set_raw_count(timer, delays[j - 1]);
+    }
+  });
+
+  const Measure total = measure(ITERATIONS * count, [&] {
+    for (size_t i = 0; i < ITERATIONS; i++) {
+      gptimer_set_raw_count(timer, 0);
+      Mycila::ThyristorDimmer::onZeroCross(0, nullptr);
+      // dimmers with the highest duty cycle are fired first
+      for (size_t j = count; j > 0; j--) {
+        gptimer_set_raw_count(timer, delays[j - 1]);
+        mock_gptimer_alarm(timer);
+      }
+    }
+  });
+
+  report("thyristor _fireTimerISR", count, total - baseline);
+
+  for (size_t i = 0; i < count; i++)
+    dimmers[i].end();
+}
+
+static void benchCycleStealing(size_t count) {
+  Mycila::CycleStealingDimmer dimmers[32];
+  for (size_t i = 0; i < count; i++) {
+    dimmers[i].setPin(pin(i));
+    dimmers[i].begin();
+    dimmers[i].setOnline(true);
+    dimmers[i].setDutyCycle(duty(i, count));
+  }
+
+  gptimer_handle_t timer = mock_gptimer(mock_gptimer_count() - 1);
+
+  // firing ISR: called once per semi-period by the shared timer, after moving the timer to the alarm count.
+  // The cost of moving the timer is measured separately and removed.
+  const Measure baseline = measure(ITERATIONS, [&] {
+    for (size_t i = 0; i < ITERATIONS; i++)
+      gptimer_set_raw_count(timer, mock_gptimer_alarm_count(timer));
+  });
+
+  const Measure total = measure(ITERATIONS, [&] {
+    for (size_t i = 0; i < ITERATIONS; i++) {
+      gptimer_set_raw_count(timer, mock_gptimer_alarm_count(timer));
+      mock_gptimer_alarm(timer);
+    }
+  });
+
+  report("cycle-stealing _fireTimerISR", count, total - baseline);
+
+  for (size_t i = 0; i < count; i++)
+    dimmers[i].end();
+}
+
+// At startup, the ZC events can be received before the semi-period is known (nominal one not set, no tracked one):
+// the thyristors with a delay must then stay off, instead of being fired at the minimum delay (full power).
+static bool checkStartup() {
+  Mycila::Dimmer::setSemiPeriod(0);
+
+  Mycila::ThyristorDimmer dimmer;
+  dimmer.enablePowerLUT(false); // the power LUT keeps the dimmer offline without semi-period
+  dimmer.setPin(pin(0));
+  dimmer.begin();
+  dimmer.setOnline(true);
+  dimmer.setDutyCycle(0.5f);
+
+  gptimer_handle_t timer = mock_gptimer(mock_gptimer_count() - 1);
+  bool fired = false;
+  for (uint64_t zc = 0; zc < 10; zc++) {
+    gptimer_set_raw_count(timer, zc * 10000);
+    Mycila::ThyristorDimmer::onZeroCross(0, nullptr);
+    fired |= mock_gpio_levels() & (1ULL << pin(0));
+    gptimer_set_raw_count(timer, zc * 10000 + 9999);
+    mock_gptimer_alarm(timer);
+    fired |= mock_gpio_levels() & (1ULL << pin(0));
+  }
+
+  dimmer.end();
+  if (fired)
+    printf("Error: a thyristor was fired at startup, before the semi-period is known\n");
+  return !fired;
+}
+
+int main() {
+  if (!checkStartup())
+    return 1;
+
+  Mycila::Dimmer::setSemiPeriod(10000);
+
+  if (!counters.hasCycles() || !counters.hasInstructions())
+    printf("Warning: perf events not available (see /proc/sys/kernel/perf_event_paranoid): only the time is reported\n\n");
+
+  printf("%-28s %7s %10s %10s %10s\n", "ISR", "dimmers", "cycles", "instr.", "ns");
+  for (size_t count : DIMMER_COUNTS)
+    benchThyristor(count);
+  for (size_t count : DIMMER_COUNTS)
+    benchCycleStealing(count);
+
+  return 0;
+}
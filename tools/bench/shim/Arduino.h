@@ -0,0 +1,10 @@
+#pragma once
+#include <esp32-hal-gpio.h>
+#include <esp32-hal-log.h>
+#include <freertos/FreeRTOS.h>
+#include <cstdint>
+#include <cstddef>
+inline void delay(uint32_t) {}
+inline void delayMicroseconds(uint32_t) {}
+inline unsigned long millis() { return 0; }
+inline unsigned long micros() { return 0; }
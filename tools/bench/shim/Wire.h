@@ -0,0 +1,13 @@
+#pragma once
+#include <Arduino.h>
+#include <cstdint>
+#include <cstddef>
+class TwoWire {
+  public:
+    void beginTransmission(uint8_t) {}
+    size_t write(uint8_t) { return 1; }
+    uint8_t endTransmission(bool = true) { return 0; }
+};
+extern TwoWire Wire;
+#define SDA 21
+#define SCL 22
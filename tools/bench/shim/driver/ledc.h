@@ -0,0 +1,5 @@
+#pragma once
+#include <esp_err.h>
+typedef int ledc_mode_t;
+typedef int ledc_channel_t;
+inline esp_err_t ledc_fade_stop(ledc_mode_t, ledc_channel_t) { return 0; }
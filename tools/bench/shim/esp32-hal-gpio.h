@@ -0,0 +1,26 @@
+#pragma once
+#include <cstdint>
+#include <cinttypes>
+#include <driver/gpio.h>
+#define LOW 0
+#define HIGH 1
+#define OUTPUT 0x03
+#define INPUT 0x01
+#ifndef ARDUINO_ISR_ATTR
+#define ARDUINO_ISR_ATTR
+#endif
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+#ifndef DRAM_ATTR
+#define DRAM_ATTR
+#endif
+inline void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t pin, uint8_t val);
+inline bool ledcAttach(uint8_t, uint32_t, uint8_t) { return true; }
+inline bool ledcAttachChannel(uint8_t, uint32_t, uint8_t, int8_t) { return true; }
+inline bool ledcWrite(uint8_t, uint32_t) { return true; }
+inline bool ledcDetach(uint8_t) { return true; }
+inline bool ledcFade(uint8_t, uint32_t, uint32_t, int) { return true; }
+inline bool ledcFadeWithInterruptArg(uint8_t, uint32_t, uint32_t, int, void (*)(void*), void*) { return true; }
+inline uint32_t ledcRead(uint8_t) { return 0; }
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdio>
+#include <cinttypes>
+#define ESP_LOGE(tag, ...) do { (void)tag; } while (0)
+#define ESP_LOGW(tag, ...) do { (void)tag; } while (0)
+#define ESP_LOGI(tag, ...) do { (void)tag; } while (0)
+#define ESP_LOGD(tag, ...) do { (void)tag; } while (0)
+#define ESP_LOGV(tag, ...) do { (void)tag; } while (0)
@@ -0,0 +1,2 @@
+#pragma once
+typedef void* esp_pm_lock_handle_t;
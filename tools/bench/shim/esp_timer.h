@@ -0,0 +1,4 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+inline int64_t esp_timer_get_time() { return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
@@ -0,0 +1,11 @@
+#pragma once
+#include <freertos/FreeRTOS.h>
+typedef void (*TaskFunction_t)(void*);
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char*, uint32_t, void* arg, UBaseType_t, TaskHandle_t*, BaseType_t) {
+  fn(arg);
+  return pdPASS;
+}
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 1; }
+inline BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*) { return pdPASS; }
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 0; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
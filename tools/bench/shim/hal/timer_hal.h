@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#define SOC_TIMER_GROUP_TIMERS_PER_GROUP 2
+typedef struct timg_dev_t {
+    uint64_t counter[2];
+    uint64_t reload[2];
+    uint64_t alarm[2];
+    bool auto_reload[2];
+    bool alarm_en[2];
+} timg_dev_t;
+typedef struct {
+    timg_dev_t* dev;
+    uint32_t timer_id;
+} timer_hal_context_t;
+typedef void* intr_handle_t;
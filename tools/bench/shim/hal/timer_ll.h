@@ -0,0 +1,10 @@
+#pragma once
+#include <hal/timer_hal.h>
+inline void timer_ll_trigger_soft_capture(timg_dev_t*, uint32_t) {}
+inline uint64_t timer_ll_get_counter_value(timg_dev_t* dev, uint32_t id) { return dev->counter[id]; }
+inline uint64_t timer_ll_get_reload_value(timg_dev_t* dev, uint32_t id) { return dev->reload[id]; }
+inline void timer_ll_set_reload_value(timg_dev_t* dev, uint32_t id, uint64_t v) { dev->reload[id] = v; }
+inline void timer_ll_trigger_soft_reload(timg_dev_t* dev, uint32_t id) { dev->counter[id] = dev->reload[id]; }
+inline void timer_ll_set_alarm_value(timg_dev_t* dev, uint32_t id, uint64_t v) { dev->alarm[id] = v; }
+inline void timer_ll_enable_auto_reload(timg_dev_t* dev, uint32_t id, bool en) { dev->auto_reload[id] = en; }
+inline void timer_ll_enable_alarm(timg_dev_t* dev, uint32_t id, bool en) { dev->alarm_en[id] = en; }
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ */
+#include "mock.h"
+
+#include <Wire.h>
+#include <soc/gpio_struct.h>
+
+#include "priv/inlined_gptimer.h"
+
+#include <cstring>
+
+gpio_dev_t GPIO;
+TwoWire Wire;
+
+#define MOCK_GPTIMER_MAX 8
+
+static timg_dev_t timer_devices[MOCK_GPTIMER_MAX];
+static gptimer_handle_t timers[MOCK_GPTIMER_MAX];
+static size_t timers_count = 0;
+
+esp_err_t gptimer_new_timer(const gptimer_config_t* config, gptimer_handle_t* ret_timer) {
+  if (timers_count >= MOCK_GPTIMER_MAX)
+    return ESP_ERR_NOT_FOUND;
+  gptimer_t* timer = new gptimer_t();
+  timer->hal.dev = &timer_devices[timers_count];
+  memset(timer->hal.dev, 0, sizeof(timg_dev_t));
+  timer->hal.timer_id = 0;
+  timer->resolution_hz = config->resolution_hz;
+  timers[timers_count++] = timer;
+  *ret_timer = timer;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_del_timer(gptimer_handle_t timer) {
+  for (size_t i = 0; i < timers_count; i++) {
+    if (timers[i] == timer) {
+      timers[i] = timers[--timers_count];
+      break;
+    }
+  }
+  delete timer;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t* cbs, void* user_data) {
+  timer->on_alarm = cbs->on_alarm;
+  timer->user_ctx = user_data;
+  return ESP_OK;
+}
+
+esp_err_t gptimer_enable(gptimer_handle_t timer) { return ESP_OK; }
+esp_err_t gptimer_disable(gptimer_handle_t timer) { return ESP_OK; }
+esp_err_t gptimer_start(gptimer_handle_t timer) { return ESP_OK; }
+esp_err_t gptimer_stop(gptimer_handle_t timer) { return ESP_OK; }
+esp_err_t gptimer_set_raw_count(gptimer_handle_t timer, uint64_t value) { return inlined_gptimer_set_raw_count(timer, value); }
+esp_err_t gptimer_get_raw_count(gptimer_handle_t timer, uint64_t* value) { return inlined_gptimer_get_raw_count(timer, value); }
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t* config) { return inlined_gptimer_set_alarm_action(timer, config); }
+
+size_t mock_gptimer_count() { return timers_count; }
+
+gptimer_handle_t mock_gptimer(size_t index) { return index < timers_count ? timers[index] : nullptr; }
+
+bool mock_gptimer_alarm(gptimer_handle_t timer) {
+  timg_dev_t* dev = timer->hal.dev;
+  gptimer_alarm_event_data_t event = {.count_value = dev->counter[0], .alarm_value = dev->alarm[0]};
+  return timer->on_alarm ? timer->on_alarm(timer, &event, timer->user_ctx) : false;
+}
+
+uint64_t mock_gptimer_alarm_count(gptimer_handle_t timer) { return timer->hal.dev->alarm[0]; }
+
+uint64_t mock_gpio_levels() { return GPIO.level; }
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (val)
+    GPIO.level |= 1ULL << pin;
+  else
+    GPIO.level &= ~(1ULL << pin);
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Host implementation of the ESP-IDF gptimer driver and GPIO registers, used to run the dimmer ISRs off-device.
+ */
+#pragma once
+
+#include <driver/gptimer.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Number of gptimers currently allocated by the dimmers
+ */
+size_t mock_gptimer_count();
+
+/**
+ * @brief Get an allocated gptimer, in creation order
+ */
+gptimer_handle_t mock_gptimer(size_t index);
+
+/**
+ * @brief Call the alarm callback registered on the timer, as the gptimer ISR would do
+ */
+bool mock_gptimer_alarm(gptimer_handle_t timer);
+
+/**
+ * @brief Get the count at which the alarm of the timer is set
+ */
+uint64_t mock_gptimer_alarm_count(gptimer_handle_t timer);
+
+/**
+ * @brief Get the levels of all the GPIOs (bit n is GPIO n)
+ */
+uint64_t mock_gpio_levels();
@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+#define GPIO_OUT_W1TS_REG 0x1
+#define GPIO_OUT_W1TC_REG 0x2
+#define GPIO_OUT1_W1TS_REG 0x3
+#define GPIO_OUT1_W1TC_REG 0x4
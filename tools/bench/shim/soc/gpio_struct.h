@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+typedef struct gpio_dev_t {
+    uint64_t level;
+} gpio_dev_t;
+extern gpio_dev_t GPIO;
@@ -0,0 +1,12 @@
+#pragma once
+#include <soc/gpio_struct.h>
+#include <soc/gpio_reg.h>
+inline void shim_reg_write(uint32_t reg, uint32_t v) {
+  switch (reg) {
+    case 1: GPIO.level |= v; break;
+    case 2: GPIO.level &= ~static_cast<uint64_t>(v); break;
+    case 3: GPIO.level |= static_cast<uint64_t>(v) << 32; break;
+    case 4: GPIO.level &= ~(static_cast<uint64_t>(v) << 32); break;
+  }
+}
+#define REG_WRITE(reg, val) shim_reg_write((reg), (val))
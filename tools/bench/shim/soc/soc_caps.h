@@ -0,0 +1,5 @@
+#pragma once
+#include <driver/gpio.h>
+#define SOC_LEDC_CHANNEL_NUM 8
+#define SOC_LEDC_TIMER_NUM 4
+#define SOC_LEDC_SUPPORT_FADE_STOP 1
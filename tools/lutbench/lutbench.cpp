@@ -0,0 +1,155 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Copyright (C) Mathieu Carbou
+ *
+ * Accuracy and cost of the power LUT of the phase control dimmers, run on the host (see README.md)
+ *
+ * For each candidate table size and resolution, all the Q16 duty cycles going through the LUT are sent through the same integer code as the library:
+ * - LUT::FiringDelays::lookup(): quantization to the resolution, then 16.16 interpolation between 2 entries
+ * - scaling of the Q16 firing delay to timer ticks, like the ZC ISR of the thyristor dimmers (Q0.32 fraction x semi-period)
+ * The power really delivered by the firing delay (sine square CDF) is then compared to the requested one, and the firing delay to the analytic inverse CDF.
+ */
+#include <priv/power_lut.h>
+#include <priv/timer_service.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define REPEATS 50
+
+struct Options {
+    double load = 3000;          // W
+    uint32_t semiPeriod = 10000; // us
+    size_t curveSize = 0;        // table to export the error curve of (0: none)
+    uint32_t curveResolution = 0;
+};
+
+struct Result {
+    double maxError = 0; // W
+    double rmsError = 0; // W
+    double maxErrorDuty = 0;
+    double maxDelayError = 0; // us
+    double lookupsPerSecond = 0;
+};
+
+static Options options;
+
+// firing delay of the ZC ISR in timer ticks, from the Q16 firing delay (see ThyristorDimmer::Group::_publishFiringSchedule() and _onZeroCross())
+static inline uint32_t toTicks(uint16_t delay, uint32_t semiPeriodTicks) {
+  const uint32_t fraction = static_cast<uint32_t>(delay) * 65537;
+  return (static_cast<uint64_t>(fraction) * semiPeriodTicks + (1ULL << 31)) >> 32;
+}
+
+template <size_t LEN, uint32_t RESOLUTION>
+static Result bench() {
+  // generated at compile time, like in the library
+  static constexpr Mycila::LUT::FiringDelays<LEN, RESOLUTION> table{};
+  const uint32_t semiPeriodTicks = options.semiPeriod * Mycila::TimerService::TICKS_PER_US;
+  const bool curve = options.curveSize == LEN && options.curveResolution == RESOLUTION;
+
+  Result result;
+  if (options.curveSize && !curve)
+    return result;
+  if (curve)
+    printf("duty,requested_w,delivered_w,error_w,delay_us,exact_delay_us\n");
+
+  double sum2 = 0;
+  size_t count = 0;
+
+  // 0 and DUTY_CYCLE_RAW_MAX bypass the LUT (see PhaseControlDimmer::_updateDutyCycleRaw())
+  for (uint32_t duty = 1; duty < 0xFFFF; duty++) {
+    const double requested = duty / 65535.0;
+    const uint32_t ticks = toTicks(table.lookup(static_cast<uint16_t>(duty)), semiPeriodTicks);
+    const double phase = static_cast<double>(ticks) / semiPeriodTicks;
+    const double delivered = Mycila::LUT::phase2duty(phase);
+    const double error = (delivered - requested) * options.load;
+    const double delayError = (phase - Mycila::LUT::duty2phase(requested)) * options.semiPeriod;
+
+    sum2 += error * error;
+    count++;
+    if (std::fabs(error) > std::fabs(result.maxError)) {
+      result.maxError = error;
+      result.maxErrorDuty = requested;
+    }
+    if (std::fabs(delayError) > std::fabs(result.maxDelayError))
+      result.maxDelayError = delayError;
+
+    if (curve && duty % 64 == 0)
+      printf("%.5f,%.2f,%.2f,%.3f,%.2f,%.2f\n", requested, requested * options.load, delivered * options.load, error, phase * options.semiPeriod, Mycila::LUT::duty2phase(requested) * options.semiPeriod);
+  }
+  result.rmsError = std::sqrt(sum2 / count);
+
+  // cost of the lookup and of the scaling to timer ticks, on all the duty cycles
+  volatile uint32_t sink = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < REPEATS; r++) {
+    uint32_t acc = 0;
+    for (uint32_t duty = 1; duty < 0xFFFF; duty++)
+      acc += toTicks(table.lookup(static_cast<uint16_t>(duty)), semiPeriodTicks);
+    sink = sink + acc;
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  result.lookupsPerSecond = elapsed > 0 ? REPEATS * 65534.0 / elapsed : 0;
+
+  if (!curve)
+    printf("%6zu %4" PRIu32 " %7zu %10.3f %10.3f %8.4f %12.2f %10.1f\n",
+           LEN,
+           RESOLUTION,
+           LEN * sizeof(uint16_t),
+           result.maxError,
+           result.rmsError,
+           result.maxErrorDuty,
+           result.maxDelayError,
+           result.lookupsPerSecond / 1e6);
+  return result;
+}
+
+template <size_t LEN>
+static void benchSize() {
+  bench<LEN, 8>();
+  bench<LEN, 10>();
+  bench<LEN, 12>();
+  bench<LEN, 14>();
+  bench<LEN, 16>();
+}
+
+static void usage(const char* name) {
+  printf("Usage: %s [--load W] [--semi-period us] [--curve SIZE RESOLUTION]\n", name);
+  printf("  --load W                  load used to express the power errors (default: 3000 W)\n");
+  printf("  --semi-period us          semi-period of the grid (default: 10000 us)\n");
+  printf("  --curve SIZE RESOLUTION   only print the error curve (CSV) of one of the benchmarked tables\n");
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--load") && i + 1 < argc) {
+      options.load = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--semi-period") && i + 1 < argc) {
+      options.semiPeriod = static_cast<uint32_t>(atoi(argv[++i]));
+    } else if (!strcmp(argv[i], "--curve") && i + 2 < argc) {
+      options.curveSize = static_cast<size_t>(atoi(argv[++i]));
+      options.curveResolution = static_cast<uint32_t>(atoi(argv[++i]));
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (!options.curveSize) {
+    printf("Load: %.0f W, semi-period: %" PRIu32 " us, timer resolution: %" PRIu32 " ticks/us\n\n", options.load, options.semiPeriod, Mycila::TimerService::TICKS_PER_US);
+    printf("%6s %4s %7s %10s %10s %8s %12s %10s\n", "size", "res", "bytes", "max err W", "rms err W", "at duty", "max delay us", "Mlookup/s");
+  }
+
+  benchSize<50>();
+  benchSize<100>();
+  benchSize<200>();
+  benchSize<400>();
+  benchSize<800>();
+
+  return 0;
+}
@@ -7,7 +7,9 @@ and the _lookupFiringDelay function behavior. It validates interpolation accurac
 bounds checking, and edge case handling.
 
 Usage:
-    python3 tools/test_lut.py [--table-size 200] [--semi-period 10000]
+    python3 tools/test_lut.py [--table-size 200] [--resolution 12] [--semi-period 10000]
+
+The table size and resolution match the MYCILA_DIMMER_LUT_SIZE and MYCILA_DIMMER_LUT_RESOLUTION build flags.
 """
 
 import argparse
@@ -27,10 +29,10 @@ except ImportError:
 class LookupTableTester:
     """Test suite for MycilaDimmer lookup table functionality"""
     
-    def __init__(self, table_size=200, semi_period=10000):
+    def __init__(self, table_size=200, semi_period=10000, resolution=12):
         self.table_size = table_size
         self.semi_period = semi_period
-        self.dimmer_resolution = 12
+        self.dimmer_resolution = resolution
         self.firing_delay_max = (1 << self.dimmer_resolution) - 1  # 4095
         self.firing_delays_scale = (table_size - 1) * (1 << (16 - self.dimmer_resolution))
         
@@ -44,8 +46,9 @@ class LookupTableTester:
 
     def simulate_lookup_firing_delay(self, duty_cycle):
         """Exact simulation of the _lookupFiringDelay function"""
-        duty = int(duty_cycle * self.firing_delay_max)
-        slot = duty * self.firing_delays_scale + (self.firing_delays_scale >> 1)
+        # Q16 duty cycle rounded to the nearest step of the resolution, clamped to the last one
+        duty = min((int(duty_cycle * 0xFFFF) + ((1 << (16 - self.dimmer_resolution)) >> 1)) >> (16 - self.dimmer_resolution), self.firing_delay_max)
+        slot = duty * self.firing_delays_scale
         index = slot >> 16
         
         # Bounds checking (like C++ would do)
@@ -217,7 +220,7 @@ class LookupTableTester:
         
         for duty_raw in range(0, min(200, self.firing_delay_max)):
             duty_cycle = duty_raw / self.firing_delay_max
-            slot = duty_raw * self.firing_delays_scale + (self.firing_delays_scale >> 1)
+            slot = duty_raw * self.firing_delays_scale
             index = slot >> 16
             
             if index != current_index:
@@ -286,6 +289,8 @@ def main():
     parser = argparse.ArgumentParser(description="Test MycilaDimmer lookup table")
     parser.add_argument("--table-size", type=int, default=200,
                         help="Size of the lookup table (default: 200)")
+    parser.add_argument("--resolution", type=int, default=12,
+                        help="Resolution in bits of the duty cycle (default: 12)")
     parser.add_argument("--semi-period", type=int, default=10000,
                         help="Semi-period in microseconds (default: 10000)")
     parser.add_argument("--test", choices=["basic", "edge", "small", "accuracy", 
@@ -294,7 +299,7 @@ def main():
     
     args = parser.parse_args()
     
-    tester = LookupTableTester(args.table_size, args.semi_period)
+    tester = LookupTableTester(args.table_size, args.semi_period, args.resolution)
     
     if args.test == "basic":
         tester.test_basic_functionality()